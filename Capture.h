@@ -0,0 +1,91 @@
+/*
+ Recorded captures of raw MPU6050 samples.
+
+ A capture is a text file with one sample per line:
+
+   t_us accX accY accZ gyroX gyroY gyroZ temp_raw [roll_true pitch_true]
+
+ where t_us is the time in microseconds since the start of the capture and the sensor
+ values are the raw register values exactly as read_word_2c() returned them, scaled to
+ LSB of the default full-scale ranges when the sensor ran at a larger range (see
+ FullScaleRange.h). The two last columns are optional and hold the true roll and pitch
+ in degrees when they are known (synthetic data or a reference system). Lines starting
+ with '#' are comments.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _Capture_h
+#define _Capture_h
+
+#include <stdio.h>
+#include <vector>
+
+struct CaptureRecord {
+    double t_us;
+    int    accX;
+    int    accY;
+    int    accZ;
+    int    gyroX;
+    int    gyroY;
+    int    gyroZ;
+    int    temp_raw;
+    bool   has_truth;
+    double roll_true;
+    double pitch_true;
+};
+
+void capture_write_header(FILE *file)
+{
+    fprintf(file, "# t_us accX accY accZ gyroX gyroY gyroZ temp_raw [roll_true pitch_true]\n");
+}
+
+void capture_write(FILE *file, const CaptureRecord &record)
+{
+    fprintf(file, "%.0f %d %d %d %d %d %d %d", record.t_us,
+            record.accX, record.accY, record.accZ,
+            record.gyroX, record.gyroY, record.gyroZ, record.temp_raw);
+    if (record.has_truth)
+        fprintf(file, " %.4f %.4f", record.roll_true, record.pitch_true);
+    fprintf(file, "\n");
+}
+
+/* Reads the next sample, skipping comments. Returns false at the end of the file */
+bool capture_read(FILE *file, CaptureRecord *record)
+{
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        int fields = sscanf(line, "%lf %d %d %d %d %d %d %d %lf %lf", &record->t_us,
+                            &record->accX, &record->accY, &record->accZ,
+                            &record->gyroX, &record->gyroY, &record->gyroZ, &record->temp_raw,
+                            &record->roll_true, &record->pitch_true);
+        if (fields < 8)
+            continue;
+        record->has_truth = (fields == 10);
+        return true;
+    }
+    return false;
+}
+
+/* Reads a whole capture into memory. Returns false if the file cannot be opened */
+bool capture_load(const char *path, std::vector<CaptureRecord> *records)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+    CaptureRecord record;
+    while (capture_read(file, &record))
+        records->push_back(record);
+    fclose(file);
+    return true;
+}
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ A local control socket: a Unix domain stream socket that takes commands of one line each
+ and answers each with one or more lines of text.
+
+ The socket is served by the loop of EventLoop.h, so a command is handled between two
+ samples, on the thread that runs them, and all of its changes are in place before the next
+ sample: no locks and no checks in the sample path. Any number of clients can be
+ connected, for example with
+
+   socat - UNIX-CONNECT:/tmp/mpu6050.sock
+
+ What the commands are is up to the handler, which gets each line without its newline and
+ appends its answer to the reply.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _ControlSocket_h
+#define _ControlSocket_h
+
+#include "EventLoop.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <list>
+#include <string>
+
+#define CONTROL_MAX_LINE               256
+#define CONTROL_READ_SIZE              512
+
+typedef void (*ControlHandler)(void *context, const char *line, std::string *reply);
+
+class ControlSocket {
+public:
+    ControlSocket() {
+        listen_fd = -1;
+        loop = NULL;
+    };
+    ~ControlSocket() { close(); };
+
+    /* Listens at the path, replacing a socket left behind by an earlier run */
+    bool open(const char *socket_path) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(socket_path) >= sizeof(address.sun_path))
+            return false;
+        snprintf(address.sun_path, sizeof(address.sun_path), "%s", socket_path);
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0)
+            return false;
+        unlink(socket_path);
+        if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, 4) != 0) {
+            ::close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        path = socket_path;
+        return true;
+    };
+    bool isOpen() { return listen_fd >= 0; };
+
+    void close() {
+        for (std::list<Client>::iterator client = clients.begin(); client != clients.end(); client++)
+            ::close(client->fd);
+        clients.clear();
+        if (listen_fd >= 0) {
+            ::close(listen_fd);
+            unlink(path.c_str());
+            listen_fd = -1;
+        }
+    };
+
+    /* Serves the socket and the connected clients on the loop, with this handler. A client
+       stays connected when the loop ends, and is served again by the next loop attached */
+    void attach(EventLoop &event_loop, ControlHandler command_handler, void *command_context) {
+        loop = &event_loop;
+        handler = command_handler;
+        context = command_context;
+        if (listen_fd >= 0)
+            loop->watch(listen_fd, EPOLLIN, acceptClient, this);
+        for (std::list<Client>::iterator client = clients.begin(); client != clients.end(); client++)
+            loop->watch(client->fd, EPOLLIN, readClient, &*client);
+    };
+
+private:
+    struct Client {
+        ControlSocket *socket;
+        int fd;
+        std::string input;
+    };
+
+    static void acceptClient(void *socket_context, uint32_t) {
+        ControlSocket &socket = *(ControlSocket *)socket_context;
+        int fd;
+        while ((fd = accept4(socket.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            Client client;
+            client.socket = &socket;
+            client.fd = fd;
+            socket.clients.push_back(client);
+            socket.loop->watch(fd, EPOLLIN, readClient, &socket.clients.back());
+        }
+    };
+
+    static void readClient(void *client_context, uint32_t) {
+        Client &client = *(Client *)client_context;
+        ControlSocket &socket = *client.socket;
+        char buffer[CONTROL_READ_SIZE];
+        ssize_t length = read(client.fd, buffer, sizeof(buffer));
+        if (length < 0 && (errno == EAGAIN || errno == EINTR))
+            return;
+        if (length <= 0) {
+            socket.drop(client);
+            return;
+        }
+        client.input.append(buffer, length);
+
+        std::string reply;
+        size_t end;
+        while ((end = client.input.find('\n')) != std::string::npos) {
+            std::string line = client.input.substr(0, end);
+            client.input.erase(0, end + 1);
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+            socket.handler(socket.context, line.c_str(), &reply);
+        }
+        if (client.input.size() > CONTROL_MAX_LINE) {
+            reply += "error: line too long\n";
+            client.input.clear();
+        }
+        // The answers are short, a client that does not read them loses the rest
+        if (!reply.empty() && send(client.fd, reply.data(), reply.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN)
+            socket.drop(client);
+    };
+
+    void drop(Client &client) {
+        loop->unwatch(client.fd);
+        ::close(client.fd);
+        for (std::list<Client>::iterator i = clients.begin(); i != clients.end(); i++)
+            if (&*i == &client) {
+                clients.erase(i);
+                return;
+            }
+    };
+
+    int listen_fd;
+    std::string path;
+    std::list<Client> clients;
+    EventLoop *loop;
+    ControlHandler handler;
+    void *context;
+};
+
+#endif
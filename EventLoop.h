@@ -0,0 +1,228 @@
+/*
+ A single-threaded event loop on epoll, with timers on one timerfd and signals on a signalfd.
+
+ Callbacks are plain functions with a context pointer, called from run() when a watched
+ file descriptor is readable or a timer is due. The timers are kept in a heap ordered by
+ their due time (CLOCK_MONOTONIC, in seconds), and only the earliest is armed in the
+ timerfd, so thousands of timers cost one file descriptor. Timers with the same due time
+ run in the order they were added.
+
+ Signals watched with watchSignals() are blocked and read from a signalfd, so their
+ callback runs between two other callbacks like any event, instead of interrupting the
+ program in the middle of a write. The loop unblocks them again when it is destroyed. A
+ program that always has work, such as a sensor that is read as fast as it answers, sets
+ it as the idle callback, which the loop calls over and over. In between it only checks
+ its descriptors when they could have an event for it: when the armed timer is due, as
+ now() tells without a system call, and every EVENT_LOOP_IDLE_POLL_SECONDS while other
+ descriptors or signals are watched.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _EventLoop_h
+#define _EventLoop_h
+
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <queue>
+#include <vector>
+
+#define EVENT_LOOP_MAX_EVENTS          16
+#define EVENT_LOOP_IDLE_POLL_SECONDS   0.01  /* Longest wait of a watched descriptor or signal behind the idle callback */
+
+typedef void (*EventCallback)(void *context);
+typedef void (*FdCallback)(void *context, uint32_t events);
+typedef void (*SignalCallback)(void *context, int signal_number);
+
+class EventLoop {
+public:
+    EventLoop() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        signal_fd = -1;
+        watched = 0;
+        sequence = 0;
+        armed_due = -1;
+        running = true;   // Until stop(), which may come before run()
+        idle_callback = NULL;
+        watch(timer_fd, EPOLLIN, NULL, NULL);
+    };
+    ~EventLoop() {
+        if (signal_fd >= 0) {
+            close(signal_fd);
+            sigprocmask(SIG_SETMASK, &unwatched_signals, NULL);
+        }
+        close(timer_fd);
+        close(epoll_fd);
+    };
+
+    /* Whether the epoll and timerfd descriptors could be made */
+    bool isValid() { return epoll_fd >= 0 && timer_fd >= 0; };
+
+    static double now() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+    };
+
+    /* Calls the callback with the events (EPOLLIN ...) whenever they occur on the descriptor */
+    bool watch(int fd, uint32_t events, FdCallback callback, void *context) {
+        if (fd >= (int)watchers.size())
+            watchers.resize(fd + 1);
+        watchers[fd].callback = callback;
+        watchers[fd].context = context;
+        struct epoll_event event;
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+            return false;
+        if (fd != timer_fd)
+            watched++;
+        return true;
+    };
+    void unwatch(int fd) {
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) == 0 && fd != timer_fd)
+            watched--;
+        if (fd < (int)watchers.size())
+            watchers[fd].callback = NULL;
+    };
+
+    /* Calls the callback once, at the due time in seconds of now() */
+    void addTimer(double due, EventCallback callback, void *context) {
+        Timer timer;
+        timer.due = due;
+        timer.sequence = sequence++;
+        timer.callback = callback;
+        timer.context = context;
+        timers.push(timer);
+        if (armed_due < 0 || due < armed_due)
+            arm(due);
+    };
+
+    /* Blocks the signals for the thread, and calls the callback with each signal that arrives
+       from then on. The destructor restores the signal mask from before, so the signals act as
+       usual again once no loop watches them. Call it before starting threads, as they inherit
+       the blocked signals */
+    bool watchSignals(const sigset_t &signals, SignalCallback callback, void *context) {
+        if (sigprocmask(SIG_BLOCK, &signals, signal_fd >= 0 ? NULL : &unwatched_signals) != 0)
+            return false;
+        bool watched = signal_fd >= 0; // A second call replaces the signals of the same signalfd
+        signal_fd = signalfd(signal_fd, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        signal_callback = callback;
+        signal_context = context;
+        return signal_fd >= 0 && (watched || watch(signal_fd, EPOLLIN, readSignals, this));
+    };
+
+    /* Calls the callback whenever there are no events left, NULL to wait for events again */
+    void setIdle(EventCallback callback, void *context) {
+        idle_callback = callback;
+        idle_context = context;
+    };
+
+    /* Runs until stop() is called, at once when it already was */
+    void run() {
+        struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+        double next_poll = 0;
+        while (running) {
+            int count = 0;
+            if (!idle_callback)
+                count = epoll_wait(epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+            else {
+                double current = now();
+                if ((armed_due >= 0 && current >= armed_due) || (watched > 0 && current >= next_poll)) {
+                    count = epoll_wait(epoll_fd, events, EVENT_LOOP_MAX_EVENTS, 0);
+                    next_poll = current + EVENT_LOOP_IDLE_POLL_SECONDS;
+                }
+            }
+            if (count < 0 && errno != EINTR)
+                break;
+            for (int i = 0; i < count && running; i++) {
+                int fd = events[i].data.fd;
+                if (fd == timer_fd)
+                    runDueTimers();
+                else if (fd < (int)watchers.size() && watchers[fd].callback)
+                    watchers[fd].callback(watchers[fd].context, events[i].events);
+            }
+            if (idle_callback && running)
+                idle_callback(idle_context);
+        }
+    };
+    void stop() { running = false; };
+
+private:
+    struct Timer {
+        double due;
+        unsigned long sequence;
+        EventCallback callback;
+        void *context;
+        bool operator>(const Timer &other) const {
+            return due > other.due || (due == other.due && sequence > other.sequence);
+        };
+    };
+    struct Watcher {
+        FdCallback callback;
+        void *context;
+    };
+
+    void arm(double due) {
+        struct itimerspec spec;
+        spec.it_interval.tv_sec = 0;
+        spec.it_interval.tv_nsec = 0;
+        spec.it_value.tv_sec = (time_t)due;
+        spec.it_value.tv_nsec = (long)((due - floor(due)) * 1e9);
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+            spec.it_value.tv_nsec = 1; // Zero would disarm the timer
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+        armed_due = due;
+    };
+    static void readSignals(void *context, uint32_t) {
+        EventLoop &loop = *(EventLoop *)context;
+        struct signalfd_siginfo info;
+        while (loop.running && read(loop.signal_fd, &info, sizeof(info)) == sizeof(info))
+            loop.signal_callback(loop.signal_context, info.ssi_signo);
+    };
+    void runDueTimers() {
+        uint64_t expirations;
+        if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+            return;
+        armed_due = -1;
+        double current = now();
+        // A callback may add timers, also due ones, which then run in this pass as well
+        while (!timers.empty() && timers.top().due <= current && running) {
+            Timer timer = timers.top();
+            timers.pop();
+            timer.callback(timer.context);
+        }
+        if (!timers.empty())
+            arm(timers.top().due);
+    };
+
+    int epoll_fd;
+    int timer_fd;
+    int signal_fd;
+    sigset_t unwatched_signals; // The signal mask before watchSignals()
+    int watched;                // Descriptors besides the timerfd
+    unsigned long sequence;
+    double armed_due;
+    bool running;
+    SignalCallback signal_callback;
+    void *signal_context;
+    EventCallback idle_callback;
+    void *idle_context;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > timers;
+    std::vector<Watcher> watchers;
+};
+
+#endif
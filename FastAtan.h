@@ -0,0 +1,107 @@
+/*
+ Polynomial approximations of atan2() and atan() in degrees, for the accelerometer angles.
+
+ atan() of libm is exact to the last bit and one of the most expensive calls per sample
+ on a Cortex-A. The accelerometer angles are far noisier than a hundredth of a degree, so
+ a short polynomial is enough. The argument is reduced to the first octant (0 to 45
+ degrees) with the symmetries of atan2(), where an odd minimax polynomial in degrees
+ is evaluated with the Horner scheme. All of it is branch free, so that the batch
+ functions vectorize (compile with -O3, see KalmanBank.h).
+
+ The maximum error is chosen at compile time with FAST_ATAN_MAX_ERROR_DEGREES, defined
+ before this file is included, and selects the shortest polynomial within it:
+
+   max. error in degrees   0.28   0.035   0.0047   0.00066   0.000095   0.000014
+   terms                   2      3       4        5         6          7
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _FastAtan_h
+#define _FastAtan_h
+
+#include <math.h>
+
+#ifndef FAST_ATAN_MAX_ERROR_DEGREES
+#define FAST_ATAN_MAX_ERROR_DEGREES    0.01
+#endif
+
+#define FAST_ATAN_SETS                 6
+#define FAST_ATAN_MAX_TERMS            7
+
+constexpr double fast_atan_error_degrees[FAST_ATAN_SETS] = { 0.284, 0.0349, 0.00467, 0.000656, 0.0000953, 0.0000142 };
+
+/* Coefficients of x, x^3, x^5 ... for atan(x) in degrees with 0 <= x <= 1, set n has n + 2 terms */
+constexpr double fast_atan_coefficients[FAST_ATAN_SETS][FAST_ATAN_MAX_TERMS] = {
+    { 55.7140564072, -10.9977595617 },
+    { 57.0298067117, -16.5407141073, 4.54577347463 },
+    { 57.2507338631, -18.4019657057, 8.38032522633, -2.23375505111 },
+    { 57.2881206956, -18.9250691545, 10.3223628465, -4.87909266915, 1.19433358568 },
+    { 57.2944742538, -19.0578839932, 11.0890452979, -6.67074231016, 3.01646682037, -0.671455303831 },
+    { 57.29555672, -19.0894456964, 11.3490419266, -7.58214492724, 4.56209742164, -1.92537739497, 0.390286123142 },
+};
+
+/* The shortest set within the error, or the most accurate one */
+constexpr int fast_atan_set(double max_error_degrees, int set = 0)
+{
+    return set == FAST_ATAN_SETS - 1 || fast_atan_error_degrees[set] <= max_error_degrees
+           ? set : fast_atan_set(max_error_degrees, set + 1);
+}
+
+const int fast_atan_selected = fast_atan_set(FAST_ATAN_MAX_ERROR_DEGREES);
+
+/* atan(x) in degrees for -1 <= x <= 1 */
+template <int set = fast_atan_selected>
+inline double fast_atan_unit_deg(double x)
+{
+    const int terms = set + 2;
+    double x2 = x * x;
+    double p = fast_atan_coefficients[set][terms - 1];
+    for (int k = terms - 2; k >= 0; k--)
+        p = p * x2 + fast_atan_coefficients[set][k];
+    return p * x;
+}
+
+/* atan2(a, b) in degrees, -180 to 180. The octants are undone with copysign() instead of
+   conditions, which the compiler can only vectorize when they select between two values */
+template <int set = fast_atan_selected>
+inline double fast_atan2_deg(double a, double b)
+{
+    double abs_a = fabs(a);
+    double abs_b = fabs(b);
+    double large = abs_a > abs_b ? abs_a : abs_b;
+    double small = abs_a > abs_b ? abs_b : abs_a;
+    double angle = fast_atan_unit_deg<set>(small / (large + 1e-300)); // 0 instead of a division by zero at the origin
+    angle = 45 - copysign(45 - angle, abs_b - abs_a);                 // Mirrored at 45 degrees when |a| > |b|
+    angle = 90 - copysign(90 - angle, b);                             // Mirrored at 90 degrees when b < 0
+    return copysign(angle, a);
+}
+
+/* atan(a / distance(b, c)) in degrees, -90 to 90, as atan_deg() in Mpu6050.h */
+template <int set = fast_atan_selected>
+inline double fast_atan_deg(double a, double b, double c)
+{
+    return fast_atan2_deg<set>(a, sqrt(b*b + c*c));
+}
+
+/* The same for a batch of samples, such as a FIFO read at once */
+template <int set = fast_atan_selected>
+void fast_atan2_deg_batch(const double *a, const double *b, double *angle, int count)
+{
+    for (int i = 0; i < count; i++)
+        angle[i] = fast_atan2_deg<set>(a[i], b[i]);
+}
+
+template <int set = fast_atan_selected>
+void fast_atan_deg_batch(const double *a, const double *b, const double *c, double *angle, int count)
+{
+    for (int i = 0; i < count; i++)
+        angle[i] = fast_atan_deg<set>(a[i], b[i], c[i]);
+}
+
+#endif
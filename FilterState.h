@@ -0,0 +1,159 @@
+/*
+ Persisted Kalman filter state, so that a restart does not have to learn the gyro bias again.
+
+ The state file is a text file with one line per sensor and temperature:
+
+   device temp_bucket roll_bias roll_P00 roll_P01 roll_P10 roll_P11 pitch_bias pitch_P00 ...
+
+ The gyro bias depends on the temperature, so the state is kept per bucket of
+ STATE_TEMP_BUCKET_DEGREES, and the bucket nearest to the current temperature is
+ restored at startup. The file is written to a temporary file first and then renamed,
+ so a crash while saving never leaves a broken state file behind.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _FilterState_h
+#define _FilterState_h
+
+#include "FusionEngine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define STATE_TEMP_BUCKET_DEGREES      5
+#define STATE_DEVICE_LENGTH            32
+
+struct KalmanAxisState {
+    double bias;
+    double P[2][2];
+};
+
+struct FilterStateEntry {
+    char            device[STATE_DEVICE_LENGTH];
+    int             temp_bucket;
+    KalmanAxisState roll;
+    KalmanAxisState pitch;
+};
+
+int state_temp_bucket(double temp_degrees_c)
+{
+    return (int)floor(temp_degrees_c / STATE_TEMP_BUCKET_DEGREES);
+}
+
+void kalman_get_state(Kalman &kalman, KalmanAxisState *state)
+{
+    state->bias = kalman.getBias();
+    for (int row = 0; row < 2; row++)
+        for (int column = 0; column < 2; column++)
+            state->P[row][column] = kalman.getP(row, column);
+}
+
+void kalman_set_state(Kalman &kalman, const KalmanAxisState &state)
+{
+    kalman.setBias(state.bias);
+    for (int row = 0; row < 2; row++)
+        for (int column = 0; column < 2; column++)
+            kalman.setP(row, column, state.P[row][column]);
+}
+
+template <AngleConvention convention>
+void kalman_engine_get_state(KalmanEngineIn<convention> &engine, FilterStateEntry *entry)
+{
+    kalman_get_state(engine.kalman_roll, &entry->roll);
+    kalman_get_state(engine.kalman_pitch, &entry->pitch);
+}
+
+template <AngleConvention convention>
+void kalman_engine_set_state(KalmanEngineIn<convention> &engine, const FilterStateEntry &entry)
+{
+    kalman_set_state(engine.kalman_roll, entry.roll);
+    kalman_set_state(engine.kalman_pitch, entry.pitch);
+}
+
+bool state_read_entry(FILE *file, FilterStateEntry *entry)
+{
+    char line[512];
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '#')
+            continue;
+        KalmanAxisState *r = &entry->roll;
+        KalmanAxisState *p = &entry->pitch;
+        int fields = sscanf(line, "%31s %d %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf", entry->device, &entry->temp_bucket,
+                            &r->bias, &r->P[0][0], &r->P[0][1], &r->P[1][0], &r->P[1][1],
+                            &p->bias, &p->P[0][0], &p->P[0][1], &p->P[1][0], &p->P[1][1]);
+        if (fields == 12)
+            return true;
+    }
+    return false;
+}
+
+void state_write_entry(FILE *file, const FilterStateEntry &entry)
+{
+    const KalmanAxisState &r = entry.roll;
+    const KalmanAxisState &p = entry.pitch;
+    fprintf(file, "%s %d %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", entry.device, entry.temp_bucket,
+            r.bias, r.P[0][0], r.P[0][1], r.P[1][0], r.P[1][1],
+            p.bias, p.P[0][0], p.P[0][1], p.P[1][0], p.P[1][1]);
+}
+
+std::vector<FilterStateEntry> state_load_all(const char *path)
+{
+    std::vector<FilterStateEntry> entries;
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return entries;
+    FilterStateEntry entry;
+    while (state_read_entry(file, &entry))
+        entries.push_back(entry);
+    fclose(file);
+    return entries;
+}
+
+/* Finds the state of the device saved at the temperature nearest to temp_degrees_c */
+bool state_load(const char *path, const char *device, double temp_degrees_c, FilterStateEntry *entry)
+{
+    std::vector<FilterStateEntry> entries = state_load_all(path);
+    int bucket = state_temp_bucket(temp_degrees_c);
+    int best   = -1;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (strcmp(entries[i].device, device) != 0)
+            continue;
+        if (best < 0 || abs(entries[i].temp_bucket - bucket) < abs(entries[best].temp_bucket - bucket))
+            best = (int)i;
+    }
+    if (best < 0)
+        return false;
+    *entry = entries[best];
+    return true;
+}
+
+/* Replaces the saved state for the device and temperature bucket of the entry, keeping the others */
+bool state_save(const char *path, const FilterStateEntry &entry)
+{
+    std::vector<FilterStateEntry> entries = state_load_all(path);
+    char temporary_path[512];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+
+    FILE *file = fopen(temporary_path, "w");
+    if (!file)
+        return false;
+    fprintf(file, "# device temp_bucket roll_bias roll_P00 roll_P01 roll_P10 roll_P11 pitch_bias pitch_P00 pitch_P01 pitch_P10 pitch_P11\n");
+    for (size_t i = 0; i < entries.size(); i++)
+        if (strcmp(entries[i].device, entry.device) != 0 || entries[i].temp_bucket != entry.temp_bucket)
+            state_write_entry(file, entries[i]);
+    state_write_entry(file, entry);
+    if (fclose(file) != 0)
+        return false;
+    return rename(temporary_path, path) == 0;
+}
+
+#endif
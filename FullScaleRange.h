@@ -0,0 +1,159 @@
+/*
+ Full-scale range selection of the gyro and accelerometer, with automatic switching.
+
+ The range is set at startup through GYRO_CONFIG and ACCEL_CONFIG. Every raw value is then
+ multiplied by a precomputed factor into LSB of the default ranges (±250 degrees per
+ second, ±2 g), so that everything after the read, the conversions, the capture files and
+ the filters, does not depend on the range.
+
+ With automatic switching a range is stepped up as soon as a sample comes near the limit
+ of the range, and stepped down again after RANGE_QUIET_SAMPLES samples that would fit in
+ the smaller range with room to spare. The sensor only uses a new range from its next
+ sample on, and a sample must never be scaled with the factor of the other range, as the
+ filters would see a jump of a factor 2. So after writing the config register the old
+ factor is kept until the data ready flag tells that a new sample has been made. No sample
+ is dropped, only the switch itself costs an extra register read per sample.
+
+ That only holds when the flag comes with a new accelerometer sample. With the low-pass
+ filter off (DLPF_CFG 0, the power on default) the flag comes at the 8 kHz of the gyro,
+ while the accelerometer outputs at 1 kHz, so the first flag after a switch may still come
+ with an accelerometer sample of the old range. Automatic switching therefore turns the
+ filter on at RANGE_DLPF_CFG, where both output together; a rate of SampleRate.h, which
+ always uses the filter, replaces it.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _FullScaleRange_h
+#define _FullScaleRange_h
+
+#include "Mpu6050.h"
+#include <stdlib.h>
+
+#define FULL_SCALE_STEPS               4
+#define RANGE_SATURATION_LSB           30000 /* Step up when a raw value gets this close to the limit of ±32767 */
+#define RANGE_QUIET_LSB                12000 /* Step down when all values would stay below this in the smaller range */
+#define RANGE_QUIET_SAMPLES            500
+#define RANGE_DLPF_CFG                 1     /* 1 kHz for both, 184 Hz accelerometer bandwidth */
+
+const int gyro_ranges_deg_per_sec[FULL_SCALE_STEPS] = { 250, 500, 1000, 2000 };
+const int accel_ranges_g[FULL_SCALE_STEPS]          = { 2, 4, 8, 16 };
+
+/* The range of one sensor, gyro or accelerometer */
+struct RangeState {
+    int    config_register;
+    int    full_scale;   /* FS_SEL of the samples being read */
+    int    pending;      /* FS_SEL written to the sensor but not yet in the samples, or -1 */
+    int    quiet_samples;
+    double factor;       /* Multiplies a raw value into LSB of the default range */
+};
+
+struct FullScaleRange {
+    RangeState gyro;
+    RangeState accel;
+    bool       automatic;
+};
+
+/* Returns the FS_SEL of a range, or -1 when the sensor has no such range */
+int full_scale_from_range(const int ranges[FULL_SCALE_STEPS], int range)
+{
+    for (int full_scale = 0; full_scale < FULL_SCALE_STEPS; full_scale++)
+        if (ranges[full_scale] == range)
+            return full_scale;
+    return -1;
+}
+
+template <class Bus>
+void range_write(Bus &bus, RangeState *state, int full_scale)
+{
+    bus.writeReg8(state->config_register, full_scale << FULL_SCALE_SHIFT);
+}
+
+void range_apply(RangeState *state, int full_scale)
+{
+    state->full_scale    = full_scale;
+    state->pending       = -1;
+    state->quiet_samples = 0;
+    state->factor        = (double)(1 << full_scale);
+}
+
+/* Selects the ranges at startup, given as FS_SEL and AFS_SEL. Call before sample_rate_configure() */
+template <class Bus>
+void range_configure(Bus &bus, FullScaleRange *range, int gyro_full_scale, int accel_full_scale, bool automatic)
+{
+    range->gyro.config_register  = REGISTER_FOR_GYRO_CONFIG;
+    range->accel.config_register = REGISTER_FOR_ACCEL_CONFIG;
+    range->automatic             = automatic;
+    if (automatic)
+        bus.writeReg8(REGISTER_FOR_CONFIG, RANGE_DLPF_CFG);
+    range_write(bus, &range->gyro, gyro_full_scale);
+    range_write(bus, &range->accel, accel_full_scale);
+    range_apply(&range->gyro, gyro_full_scale);
+    range_apply(&range->accel, accel_full_scale);
+}
+
+/* Call when the data ready flag was seen set: the sensor has made a sample with the new range */
+void range_data_ready(FullScaleRange *range)
+{
+    if (range->gyro.pending >= 0)
+        range_apply(&range->gyro, range->gyro.pending);
+    if (range->accel.pending >= 0)
+        range_apply(&range->accel, range->accel.pending);
+}
+
+/* Call before reading a sample, unless the caller waits for the data ready flag itself */
+template <class Bus>
+void range_before_read(Bus &bus, FullScaleRange *range)
+{
+    if (range->gyro.pending < 0 && range->accel.pending < 0)
+        return;
+    if (bus.readReg8(REGISTER_FOR_INT_STATUS) & DATA_READY)
+        range_data_ready(range);
+}
+
+template <class Bus>
+void range_check(Bus &bus, RangeState *state, const int raw[3])
+{
+    int largest = 0;
+    for (int axis = 0; axis < 3; axis++)
+        if (abs(raw[axis]) > largest)
+            largest = abs(raw[axis]);
+
+    int full_scale = state->full_scale;
+    if (largest >= RANGE_SATURATION_LSB && full_scale < FULL_SCALE_STEPS - 1)
+        full_scale++;
+    else if (full_scale > 0 && 2 * largest < RANGE_QUIET_LSB)
+    {
+        if (++state->quiet_samples < RANGE_QUIET_SAMPLES)
+            return;
+        full_scale--;
+    }
+    else
+        state->quiet_samples = 0;
+
+    if (full_scale == state->full_scale)
+        return;
+    range_write(bus, state, full_scale);
+    state->pending = full_scale;
+}
+
+/* Call after reading a sample with the raw values: starts a switch when the sample is near the limit of the range */
+template <class Bus>
+void range_after_read(Bus &bus, FullScaleRange *range, const int raw_accel[3], const int raw_gyro[3])
+{
+    if (!range->automatic || range->gyro.pending >= 0 || range->accel.pending >= 0)
+        return;
+    range_check(bus, &range->gyro, raw_gyro);
+    range_check(bus, &range->accel, raw_accel);
+
+    // Clear the data ready flag, so that range_before_read() waits for a sample made after the switch
+    if (range->gyro.pending >= 0 || range->accel.pending >= 0)
+        bus.readReg8(REGISTER_FOR_INT_STATUS);
+}
+
+#endif
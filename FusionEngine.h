@@ -0,0 +1,565 @@
+/*
+ Fusion engines with a common interface, so that the engine can be chosen at startup.
+
+ Every engine has the same shape as the Kalman class: setAngle() seeds it with the
+ starting angles, setGyroBias() with gyro offsets known from a calibration, and
+ getAngle() feeds it one sample and returns the new roll and pitch. getAngle() is the same
+ as update() followed by getAngles(), for code that needs the angles of fewer samples
+ than it feeds: engines with lazy_angles keep the gravity direction as a vector and only
+ turn it into degrees in getAngles(), so their trig cost follows the output rate.
+ Engines without needs_accel_angles do not use the roll and pitch of the sample, so the
+ caller may leave them out.
+ The engines are plain classes without virtual functions. Code that runs them is written
+ as a template over the engine type (see run_fusion() in ito-mpu6050-kalman-raspberry.c),
+ and the choice is made once with a switch on FusionEngineId, so the hot loop is fully
+ inlined for the chosen engine and pays no virtual-call cost.
+
+ The accelerometer angles have two conventions: either pitch is restricted to ±90 degrees
+ and roll covers ±180, or the other way around. The convention is a template parameter of
+ every engine, chosen at startup with the engine in the same way, and the plain names
+ (KalmanEngine ...) are the engines in the convention of PITCH_RESTRICT_90_DEG, so include
+ this file after it has been defined (or not). Engines with convention_free_state keep the
+ direction of gravity, which is the same in both conventions, and can give their angles in
+ either with getAnglesIn(), so both conventions of one filter cost a second conversion only
+ (see SecondConvention).
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _FusionEngine_h
+#define _FusionEngine_h
+
+#include "Kalman.h"
+#include "Madgwick.h"
+#include "Mahony.h"
+#include "Mpu6050.h"
+#include "RateIntegration.h"
+#include <string.h>
+
+enum AngleConvention {
+    PITCH_RESTRICTED,      /* Pitch -90 to 90 degrees, roll -180 to 180 */
+    ROLL_RESTRICTED,       /* Roll -90 to 90 degrees, pitch -180 to 180 */
+    ANGLE_CONVENTION_COUNT
+};
+
+const char *angle_convention_names[ANGLE_CONVENTION_COUNT] = { "pitch", "roll" };
+
+#define OTHER_CONVENTION(convention)   ((convention) == PITCH_RESTRICTED ? ROLL_RESTRICTED : PITCH_RESTRICTED)
+
+#ifdef PITCH_RESTRICT_90_DEG
+#define DEFAULT_ANGLE_CONVENTION       PITCH_RESTRICTED
+#else
+#define DEFAULT_ANGLE_CONVENTION       ROLL_RESTRICTED
+#endif
+
+/* Returns the convention that restricts the named axis, or ANGLE_CONVENTION_COUNT if there is none */
+AngleConvention angle_convention_from_name(const char *name)
+{
+    for (int i = 0; i < ANGLE_CONVENTION_COUNT; i++)
+        if (strcmp(name, angle_convention_names[i]) == 0)
+            return (AngleConvention)i;
+    return ANGLE_CONVENTION_COUNT;
+}
+
+/* The accelerometer-only roll and pitch in degrees */
+void accel_angles(AngleConvention convention, double accX, double accY, double accZ, double *roll, double *pitch)
+{
+    if (convention == PITCH_RESTRICTED)
+    {
+        /* Eq. 25 and 26 from source for equations */
+        *roll  = atan2_deg(accY, accZ);
+        *pitch = atan_deg(-accX, accY, accZ);
+    }
+    else
+    {
+        /* Eq. 28 and 29 from source for equations */
+        *roll  = atan_deg(accY, accX, accZ);
+        *pitch = atan2_deg(-accX, accZ);
+    }
+}
+
+/* The accelerometer-only angles of both conventions, indexed by AngleConvention, with the squares
+   of the axes computed once */
+void accel_angles_both(double accX, double accY, double accZ, double roll[2], double pitch[2])
+{
+    double xx = accX * accX;
+    double yy = accY * accY;
+    double zz = accZ * accZ;
+    roll[PITCH_RESTRICTED]  = atan2_deg(accY, accZ);
+    pitch[PITCH_RESTRICTED] = atan_deg_of_distance(-accX, sqrt(yy + zz));
+    roll[ROLL_RESTRICTED]   = atan_deg_of_distance(accY, sqrt(xx + zz));
+    pitch[ROLL_RESTRICTED]  = atan2_deg(-accX, accZ);
+}
+
+/* One converted sample as the engines see it */
+struct ImuSample {
+    double accX;       /* Accelerometer, any unit */
+    double accY;
+    double accZ;
+    double roll_rate;  /* Gyro X in degrees per second */
+    double pitch_rate; /* Gyro Y in degrees per second */
+    double yaw_rate;   /* Gyro Z in degrees per second */
+    double roll;       /* Roll calculated from the accelerometer only, in degrees */
+    double pitch;      /* Pitch calculated from the accelerometer only, in degrees */
+};
+
+enum FusionEngineId {
+    FUSION_KALMAN,
+    FUSION_COMPLEMENTARY,
+    FUSION_MADGWICK,
+    FUSION_MAHONY,
+    FUSION_GRAVITY,
+    FUSION_ENGINE_COUNT
+};
+
+const char *fusion_engine_names[FUSION_ENGINE_COUNT] = { "kalman", "complementary", "madgwick", "mahony", "gravity" };
+
+/* Returns the engine with the given name, or FUSION_ENGINE_COUNT if there is none */
+FusionEngineId fusion_engine_from_name(const char *name)
+{
+    for (int i = 0; i < FUSION_ENGINE_COUNT; i++)
+        if (strcmp(name, fusion_engine_names[i]) == 0)
+            return (FusionEngineId)i;
+    return FUSION_ENGINE_COUNT;
+}
+
+/* Converts raw register values to a sample, including the accelerometer-only angles */
+ImuSample imu_sample_from_raw(double accX, double accY, double accZ, double gyroX, double gyroY, double gyroZ,
+                              AngleConvention convention = DEFAULT_ANGLE_CONVENTION)
+{
+    ImuSample sample;
+    sample.accX       = accX;
+    sample.accY       = accY;
+    sample.accZ       = accZ;
+    sample.roll_rate  = convert_to_deg_per_sec(gyroX);
+    sample.pitch_rate = convert_to_deg_per_sec(gyroY);
+    sample.yaw_rate   = convert_to_deg_per_sec(gyroZ);
+    accel_angles(convention, accX, accY, accZ, &sample.roll, &sample.pitch);
+    return sample;
+}
+
+/* Turns the gravity direction estimated by a quaternion filter into roll and pitch in degrees */
+void gravity_to_angles(AngleConvention convention, double gx, double gy, double gz, double *roll, double *pitch)
+{
+    accel_angles(convention, gx, gy, gz, roll, pitch);
+}
+
+/* The gravity direction of roll and pitch in degrees, as the accelerometer measures it at rest */
+void angles_to_gravity(AngleConvention convention, double roll, double pitch, double gravity[3])
+{
+    if (convention == PITCH_RESTRICTED)
+    {
+        gravity[0] = -sin(pitch / RAD_TO_DEG);
+        gravity[1] =  sin(roll / RAD_TO_DEG) * cos(pitch / RAD_TO_DEG);
+        gravity[2] =  cos(roll / RAD_TO_DEG) * cos(pitch / RAD_TO_DEG);
+    }
+    else
+    {
+        gravity[0] = -sin(pitch / RAD_TO_DEG) * cos(roll / RAD_TO_DEG);
+        gravity[1] =  sin(roll / RAD_TO_DEG);
+        gravity[2] =  cos(pitch / RAD_TO_DEG) * cos(roll / RAD_TO_DEG);
+    }
+}
+
+/* Two Kalman filters, one per axis, including the handling of the ±90 degree restricted axis */
+template <AngleConvention angle_convention>
+class KalmanEngineIn {
+public:
+    static const FusionEngineId id = FUSION_KALMAN;
+    static const AngleConvention convention = angle_convention;
+    static const bool lazy_angles = false;
+    static const bool needs_accel_angles = true;
+    static const bool convention_free_state = false;
+
+    KalmanEngineIn() {
+        adaptive                 = false;
+        correction_interval      = 1;
+        samples_since_correction = 0;
+        correction_requested     = false;
+    };
+
+    void setAngle(double roll, double pitch) {
+        kalman_roll.setAngle(roll);
+        kalman_pitch.setAngle(pitch);
+        roll_kalman  = roll;
+        pitch_kalman = pitch;
+    };
+    /* The Kalman filter starts from this bias instead of learning it from 0 */
+    void setGyroBias(double roll_bias, double pitch_bias, double) {
+        kalman_roll.setBias(roll_bias);
+        kalman_pitch.setBias(pitch_bias);
+    };
+    /* Any higher order than Euler integrates with the trapezoidal rule, see Kalman::setTrapezoidal */
+    void setIntegration(RateIntegration integration) {
+        kalman_roll.setTrapezoidal(integration != INTEGRATE_EULER);
+        kalman_pitch.setTrapezoidal(integration != INTEGRATE_EULER);
+    };
+    /* Adaptive measurement noise on both axes, see Kalman::setAdaptive */
+    void setAdaptive(bool newAdaptive) {
+        adaptive = newAdaptive;
+        kalman_roll.setAdaptive(adaptive);
+        kalman_pitch.setAdaptive(adaptive);
+    };
+    /* Multi-rate: the gyro rates are integrated at every update, the accelerometer angles only
+       correct the estimate at one in interval updates, and at the next update after
+       requestCorrection(). Between corrections the angles of the samples are not used */
+    void setCorrectionInterval(int interval) {
+        correction_interval = interval < 1 ? 1 : interval;
+    };
+    void requestCorrection() { correction_requested = true; };
+    /* Whether the next update corrects, so the caller can skip the accelerometer angles otherwise */
+    bool correctsNext() {
+        return correction_requested || samples_since_correction + 1 >= correction_interval;
+    };
+    /* Same tuning for both axes */
+    void setTuning(double Q_angle, double Q_bias, double R_measure) {
+        kalman_roll.setQangle(Q_angle);
+        kalman_roll.setQbias(Q_bias);
+        kalman_roll.setRmeasure(R_measure);
+        kalman_pitch.setQangle(Q_angle);
+        kalman_pitch.setQbias(Q_bias);
+        kalman_pitch.setRmeasure(R_measure);
+    };
+    void update(const ImuSample &sample, double dt) {
+        double roll_rate  = sample.roll_rate;
+        double pitch_rate = sample.pitch_rate;
+        if (!correctsNext())
+        {
+            samples_since_correction++;
+            predict(roll_rate, pitch_rate, dt);
+            return;
+        }
+        samples_since_correction = 0;
+        correction_requested     = false;
+
+        double acc_norm   = adaptive ? convert_to_g(sqrt(sample.accX*sample.accX + sample.accY*sample.accY + sample.accZ*sample.accZ)) : 1;
+        if (convention == PITCH_RESTRICTED)
+        {
+            /* Let pitch have -90 and 90 degrees to be the continuous (and roll ±180) */
+            if ( abs(sample.roll)<= 90 || abs(roll_kalman)<= 90 )
+                roll_kalman = kalman_roll.getAngle(sample.roll, roll_rate, dt, acc_norm);
+            else
+            {
+                kalman_roll.setAngle(sample.roll);
+                roll_kalman = sample.roll;
+            }
+            pitch_rate   = max_90_deg_correction(pitch_rate, roll_kalman);
+            pitch_kalman = kalman_pitch.getAngle(sample.pitch, pitch_rate, dt, acc_norm);
+        }
+        else
+        {
+            /* Let roll have -90 and 90 degrees to be the continuous (and pitch ±180) */
+            if ( abs(sample.pitch)<= 90 || abs(pitch_kalman)<= 90 )
+                pitch_kalman = kalman_pitch.getAngle(sample.pitch, pitch_rate, dt, acc_norm);
+            else
+            {
+                kalman_pitch.setAngle(sample.pitch);
+                pitch_kalman = sample.pitch;
+            }
+            roll_rate   = max_90_deg_correction(roll_rate, pitch_kalman);
+            roll_kalman = kalman_roll.getAngle(sample.roll, roll_rate, dt, acc_norm);
+        }
+    };
+    void getAngles(double *roll, double *pitch) {
+        *roll  = roll_kalman;
+        *pitch = pitch_kalman;
+    };
+    void getAngle(const ImuSample &sample, double dt, double *roll, double *pitch) {
+        update(sample, dt);
+        getAngles(roll, pitch);
+    };
+
+    Kalman kalman_roll;
+    Kalman kalman_pitch;
+
+private:
+    void predict(double roll_rate, double pitch_rate, double dt) {
+        if (convention == PITCH_RESTRICTED)
+        {
+            roll_kalman  = kalman_roll.predict(roll_rate, dt);
+            pitch_kalman = kalman_pitch.predict(max_90_deg_correction(pitch_rate, roll_kalman), dt);
+        }
+        else
+        {
+            pitch_kalman = kalman_pitch.predict(pitch_rate, dt);
+            roll_kalman  = kalman_roll.predict(max_90_deg_correction(roll_rate, pitch_kalman), dt);
+        }
+    };
+
+    int  correction_interval;
+    int  samples_since_correction;
+    bool correction_requested;
+    bool adaptive;
+    double roll_kalman;
+    double pitch_kalman;
+};
+
+typedef KalmanEngineIn<DEFAULT_ANGLE_CONVENTION> KalmanEngine;
+
+/* The complementary filter that main() has always printed next to the Kalman filter */
+template <AngleConvention angle_convention>
+class ComplementaryEngineIn {
+public:
+    static const FusionEngineId id = FUSION_COMPLEMENTARY;
+    static const AngleConvention convention = angle_convention;
+    static const bool lazy_angles = false;
+    static const bool needs_accel_angles = true;
+    static const bool convention_free_state = false;
+
+    ComplementaryEngineIn() {
+        coefficient = 0.93;
+        roll_bias   = 0;
+        pitch_bias  = 0;
+    };
+
+    void setAngle(double roll, double pitch) {
+        roll_complementary  = roll;
+        pitch_complementary = pitch;
+    };
+    void setGyroBias(double newRoll_bias, double newPitch_bias, double) {
+        roll_bias  = newRoll_bias;
+        pitch_bias = newPitch_bias;
+    };
+    void update(const ImuSample &sample, double dt) {
+        double roll_rate  = sample.roll_rate - roll_bias;
+        double pitch_rate = sample.pitch_rate - pitch_bias;
+        if (convention == PITCH_RESTRICTED)
+        {
+            if ( abs(sample.roll) > 90 && abs(roll_complementary) > 90 )
+                roll_complementary = sample.roll;
+            pitch_rate = max_90_deg_correction(pitch_rate, roll_complementary);
+        }
+        else
+        {
+            if ( abs(sample.pitch) > 90 && abs(pitch_complementary) > 90 )
+                pitch_complementary = sample.pitch;
+            roll_rate = max_90_deg_correction(roll_rate, pitch_complementary);
+        }
+        roll_complementary  = coefficient * (roll_complementary + roll_rate * dt) + (1 - coefficient) * sample.roll;
+        pitch_complementary = coefficient * (pitch_complementary + pitch_rate * dt) + (1 - coefficient) * sample.pitch;
+    };
+    void getAngles(double *roll, double *pitch) {
+        *roll  = roll_complementary;
+        *pitch = pitch_complementary;
+    };
+    void getAngle(const ImuSample &sample, double dt, double *roll, double *pitch) {
+        update(sample, dt);
+        getAngles(roll, pitch);
+    };
+
+    void setCoefficient(double newCoefficient) { coefficient = newCoefficient; };
+    double getCoefficient() { return coefficient; };
+
+private:
+    double coefficient; // Weight of the integrated gyro, the accelerometer gets the rest
+    double roll_bias;
+    double pitch_bias;
+    double roll_complementary;
+    double pitch_complementary;
+};
+
+typedef ComplementaryEngineIn<DEFAULT_ANGLE_CONVENTION> ComplementaryEngine;
+
+/* Wraps a quaternion filter (Madgwick or Mahony) in the common interface */
+template <class Filter, FusionEngineId engine_id, AngleConvention angle_convention = DEFAULT_ANGLE_CONVENTION>
+class QuaternionEngine {
+public:
+    static const FusionEngineId id = engine_id;
+    static const AngleConvention convention = angle_convention;
+    static const bool lazy_angles = true;
+    static const bool needs_accel_angles = false;
+    static const bool convention_free_state = true;
+
+    QuaternionEngine() { setGyroBias(0, 0, 0); };
+
+    void setAngle(double roll, double pitch) {
+        if (convention == PITCH_RESTRICTED)
+            filter.setAngle(roll, pitch);
+        else
+        {
+            /* The quaternion filters take roll and pitch in the pitch restricted convention */
+            double gravity[3];
+            angles_to_gravity(convention, roll, pitch, gravity);
+            filter.setAngle(atan2_deg(gravity[1], gravity[2]), atan_deg(-gravity[0], gravity[1], gravity[2]));
+        }
+    };
+    void setGyroBias(double roll_bias, double pitch_bias, double yaw_bias) {
+        bias[0] = roll_bias;
+        bias[1] = pitch_bias;
+        bias[2] = yaw_bias;
+    };
+    void update(const ImuSample &sample, double dt) {
+        filter.update(sample.roll_rate - bias[0], sample.pitch_rate - bias[1], sample.yaw_rate - bias[2],
+                      sample.accX, sample.accY, sample.accZ, dt);
+    };
+    void getAngles(double *roll, double *pitch) { getAnglesIn(convention, roll, pitch); };
+    void getAnglesIn(AngleConvention other_convention, double *roll, double *pitch) {
+        gravity_to_angles(other_convention, filter.getGravityX(), filter.getGravityY(), filter.getGravityZ(), roll, pitch);
+    };
+    void getAngle(const ImuSample &sample, double dt, double *roll, double *pitch) {
+        update(sample, dt);
+        getAngles(roll, pitch);
+    };
+
+    Filter filter;
+
+private:
+    double bias[3];
+};
+
+typedef QuaternionEngine<Madgwick, FUSION_MADGWICK> MadgwickEngine;
+typedef QuaternionEngine<Mahony, FUSION_MAHONY>     MahonyEngine;
+
+/* A complementary filter on the gravity vector instead of on the angles. The estimated
+   direction of gravity in the sensor frame is rotated by the gyro rates and pulled towards
+   the normalized accelerometer, which needs no trig at all. The accelerometer-only angles
+   of the sample are not used, and roll and pitch are only calculated in getAngles() */
+template <AngleConvention angle_convention>
+class GravityEngineIn {
+public:
+    static const FusionEngineId id = FUSION_GRAVITY;
+    static const AngleConvention convention = angle_convention;
+    static const bool lazy_angles = true;
+    static const bool needs_accel_angles = false;
+    static const bool convention_free_state = true;
+
+    GravityEngineIn() {
+        coefficient = 0.98;
+        setGyroBias(0, 0, 0);
+        setAngle(0, 0);
+    };
+
+    void setAngle(double roll, double pitch) {
+        angles_to_gravity(convention, roll, pitch, gravity);
+    };
+    void setGyroBias(double roll_bias, double pitch_bias, double yaw_bias) {
+        bias[0] = roll_bias;
+        bias[1] = pitch_bias;
+        bias[2] = yaw_bias;
+    };
+    void update(const ImuSample &sample, double dt) {
+        double wx = (sample.roll_rate - bias[0]) / RAD_TO_DEG;
+        double wy = (sample.pitch_rate - bias[1]) / RAD_TO_DEG;
+        double wz = (sample.yaw_rate - bias[2]) / RAD_TO_DEG;
+
+        /* A fixed direction seen from the rotating sensor turns the other way: dg/dt = g x w */
+        double gx = gravity[0] + (gravity[1]*wz - gravity[2]*wy) * dt;
+        double gy = gravity[1] + (gravity[2]*wx - gravity[0]*wz) * dt;
+        double gz = gravity[2] + (gravity[0]*wy - gravity[1]*wx) * dt;
+
+        double acc_norm = sqrt(sample.accX*sample.accX + sample.accY*sample.accY + sample.accZ*sample.accZ);
+        if (acc_norm > 0)
+        {
+            double weight = (1 - coefficient) / acc_norm;
+            gx = coefficient * gx + weight * sample.accX;
+            gy = coefficient * gy + weight * sample.accY;
+            gz = coefficient * gz + weight * sample.accZ;
+        }
+
+        double norm_reciprocal = 1 / sqrt(gx*gx + gy*gy + gz*gz);
+        gravity[0] = gx * norm_reciprocal;
+        gravity[1] = gy * norm_reciprocal;
+        gravity[2] = gz * norm_reciprocal;
+    };
+    void getAngles(double *roll, double *pitch) { getAnglesIn(convention, roll, pitch); };
+    void getAnglesIn(AngleConvention other_convention, double *roll, double *pitch) {
+        gravity_to_angles(other_convention, gravity[0], gravity[1], gravity[2], roll, pitch);
+    };
+    void getAngle(const ImuSample &sample, double dt, double *roll, double *pitch) {
+        update(sample, dt);
+        getAngles(roll, pitch);
+    };
+
+    void setCoefficient(double newCoefficient) { coefficient = newCoefficient; };
+    double getCoefficient() { return coefficient; };
+    double getGravityX() { return gravity[0]; };
+    double getGravityY() { return gravity[1]; };
+    double getGravityZ() { return gravity[2]; };
+
+private:
+    double coefficient; // Weight of the rotated estimate per sample, the accelerometer gets the rest
+    double bias[3];
+    double gravity[3];  // Unit vector, as the accelerometer measures it at rest
+};
+
+typedef GravityEngineIn<DEFAULT_ANGLE_CONVENTION> GravityEngine;
+
+/* The angles of an engine with convention_free_state in the other convention, without running
+   a second filter: updating it does nothing, and its angles are those of the engine it views,
+   so it is updated after that engine */
+template <class Engine>
+class ConventionView {
+public:
+    static const FusionEngineId id = Engine::id;
+    static const AngleConvention convention = OTHER_CONVENTION(Engine::convention);
+    static const bool lazy_angles = true;
+    static const bool needs_accel_angles = false;
+    static const bool convention_free_state = true;
+
+    ConventionView() { engine = NULL; };
+
+    void view(Engine *viewed) { engine = viewed; };
+    void setAngle(double, double) {};
+    void setGyroBias(double, double, double) {};
+    void update(const ImuSample &, double) {};
+    void getAngles(double *roll, double *pitch) { engine->getAnglesIn(convention, roll, pitch); };
+    void getAngle(const ImuSample &, double, double *roll, double *pitch) { getAngles(roll, pitch); };
+
+private:
+    Engine *engine;
+};
+
+/* The engine in one convention (In<>::type), and the engine that gives the other convention
+   next to it (Second<>::type): a second filter, or a view of the same filter for the engines
+   with convention_free_state */
+template <class Engine, AngleConvention convention>
+struct EngineIn;
+
+template <AngleConvention engine_convention, AngleConvention convention>
+struct EngineIn<KalmanEngineIn<engine_convention>, convention> {
+    typedef KalmanEngineIn<convention> type;
+};
+
+template <AngleConvention engine_convention, AngleConvention convention>
+struct EngineIn<ComplementaryEngineIn<engine_convention>, convention> {
+    typedef ComplementaryEngineIn<convention> type;
+};
+
+template <class Filter, FusionEngineId engine_id, AngleConvention engine_convention, AngleConvention convention>
+struct EngineIn<QuaternionEngine<Filter, engine_id, engine_convention>, convention> {
+    typedef QuaternionEngine<Filter, engine_id, convention> type;
+};
+
+template <AngleConvention engine_convention, AngleConvention convention>
+struct EngineIn<GravityEngineIn<engine_convention>, convention> {
+    typedef GravityEngineIn<convention> type;
+};
+
+template <class Engine, bool view = Engine::convention_free_state>
+struct SecondConvention {
+    typedef typename EngineIn<Engine, OTHER_CONVENTION(Engine::convention)>::type type;
+};
+
+template <class Engine>
+struct SecondConvention<Engine, true> {
+    typedef ConventionView<Engine> type;
+};
+
+/* Sets up the engine of the other convention next to the first */
+template <class Engine, class Second>
+void second_convention_start(Second &, Engine &)
+{
+}
+
+template <class Engine>
+void second_convention_start(ConventionView<Engine> &second, Engine &first)
+{
+    second.view(&first);
+}
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ Golden outputs of the fusion engines on a capture, to prove that optimized code gives the
+ same angles as the code it replaces.
+
+ The golden file is a text file with, per engine, a line
+
+   engine samples stride hash label
+
+ followed by the roll and pitch of every stride-th sample, one pair per line, printed with
+ 17 significant digits so that they read back to the same bits. The hash is FNV-1a over
+ the bits of the roll and pitch of every sample, so any change of any output is found,
+ even in the samples between the stored ones. Lines starting with '#' are comments.
+
+ An exact check compares the hashes. A variant that is allowed to differ a little (float,
+ fixed point, polynomial trig) is checked with a tolerance in degrees against the stored
+ samples instead.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _GoldenReplay_h
+#define _GoldenReplay_h
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define GOLDEN_STRIDE                  10
+#define GOLDEN_LABEL_LENGTH            32
+#define GOLDEN_HASH_START              0xcbf29ce484222325ULL /* FNV-1a 64 bit offset basis */
+#define GOLDEN_HASH_PRIME              0x100000001b3ULL
+
+/* The outputs of one engine on one capture */
+struct GoldenOutput {
+    char                label[GOLDEN_LABEL_LENGTH];
+    int                 samples;
+    int                 stride;
+    unsigned long long  hash;
+    std::vector<double> roll;  /* Of sample 0, stride, 2 * stride ... */
+    std::vector<double> pitch;
+};
+
+void golden_start(GoldenOutput *output, const char *label, int stride)
+{
+    snprintf(output->label, sizeof(output->label), "%s", label);
+    output->samples = 0;
+    output->stride  = stride;
+    output->hash    = GOLDEN_HASH_START;
+    output->roll.clear();
+    output->pitch.clear();
+}
+
+void golden_hash_add(unsigned long long *hash, double value)
+{
+    unsigned char bytes[sizeof(double)];
+    memcpy(bytes, &value, sizeof(double));
+    for (unsigned int i = 0; i < sizeof(double); i++)
+        *hash = (*hash ^ bytes[i]) * GOLDEN_HASH_PRIME;
+}
+
+/* Adds the angles of the next sample */
+void golden_add(GoldenOutput *output, double roll, double pitch)
+{
+    golden_hash_add(&output->hash, roll);
+    golden_hash_add(&output->hash, pitch);
+    if (output->samples % output->stride == 0)
+    {
+        output->roll.push_back(roll);
+        output->pitch.push_back(pitch);
+    }
+    output->samples++;
+}
+
+bool golden_save(const char *path, const char *capture_path, const std::vector<GoldenOutput> &outputs)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+    fprintf(file, "# Golden outputs of %s\n", capture_path);
+    for (size_t e = 0; e < outputs.size(); e++)
+    {
+        const GoldenOutput &output = outputs[e];
+        fprintf(file, "engine %d %d %016llx %s\n", output.samples, output.stride, output.hash, output.label);
+        for (size_t i = 0; i < output.roll.size(); i++)
+            fprintf(file, "%.17g %.17g\n", output.roll[i], output.pitch[i]);
+    }
+    return fclose(file) == 0;
+}
+
+/* Reads all engines of a golden file. Returns false if it cannot be opened or is broken */
+bool golden_load(const char *path, std::vector<GoldenOutput> *outputs)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+    char line[256];
+    bool valid = true;
+    while (valid && fgets(line, sizeof(line), file))
+    {
+        GoldenOutput output;
+        double roll, pitch;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "engine %d %d %llx %31[^\n]", &output.samples, &output.stride, &output.hash, output.label) == 4
+            && output.stride > 0)
+            outputs->push_back(output);
+        else if (!outputs->empty() && sscanf(line, "%lf %lf", &roll, &pitch) == 2)
+        {
+            outputs->back().roll.push_back(roll);
+            outputs->back().pitch.push_back(pitch);
+        }
+        else
+            valid = false;
+    }
+    fclose(file);
+    return valid;
+}
+
+/* The engine with the label, or NULL */
+const GoldenOutput *golden_find(const std::vector<GoldenOutput> &outputs, const char *label)
+{
+    for (size_t e = 0; e < outputs.size(); e++)
+        if (strcmp(outputs[e].label, label) == 0)
+            return &outputs[e];
+    return NULL;
+}
+
+/* Difference between two angles in degrees, across ±180, and infinite for NaN */
+double golden_difference(double a, double b)
+{
+    double difference = fabs(a - b);
+    if (difference > 180)
+        difference = 360 - difference;
+    return difference == difference ? difference : INFINITY;
+}
+
+/* Largest difference in degrees between the stored samples of two outputs, infinite when they do not match up */
+double golden_max_difference(const GoldenOutput &golden, const GoldenOutput &output)
+{
+    if (golden.samples != output.samples || golden.stride != output.stride || golden.roll.size() != output.roll.size())
+        return INFINITY;
+    double largest = 0;
+    for (size_t i = 0; i < golden.roll.size(); i++)
+    {
+        largest = fmax(largest, golden_difference(golden.roll[i], output.roll[i]));
+        largest = fmax(largest, golden_difference(golden.pitch[i], output.pitch[i]));
+    }
+    return largest;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ Fast startup calibration of the gyro offsets, only done while the sensor is lying still.
+
+ A short window of samples is collected at startup. If the variance of both the
+ accelerometer and the gyro is below the limits the sensor is taken to be still, and the
+ mean gyro rate of each axis is its offset. If anything moved during the window the
+ calibration is skipped, and the filters learn the bias the slow way as before.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _GyroCalibration_h
+#define _GyroCalibration_h
+
+#include "Mpu6050.h"
+
+#define CALIBRATION_SAMPLES            100   /* About 0.3 s when the loop reads the sensor as fast as it answers */
+#define CALIBRATION_MIN_SAMPLES        20    /* For a mean and a variance worth deciding on at a low rate */
+#define CALIBRATION_SECONDS            0.3   /* Of the window at a configured rate */
+#define STILL_MAX_GYRO_STDDEV          1.0   /* Degrees per second */
+#define STILL_MAX_ACCEL_STDDEV         0.02  /* g */
+
+/* Running mean and variance (Welford) of the six axes */
+struct GyroCalibration {
+    int    count;
+    double mean[6];
+    double m2[6];
+    bool   still;
+    double offset[3]; /* Gyro X, Y and Z offset in degrees per second, valid when still */
+};
+
+/* Samples in the window at a configured rate, CALIBRATION_SECONDS between CALIBRATION_MIN_SAMPLES
+   and CALIBRATION_SAMPLES, or CALIBRATION_SAMPLES without a rate (0) */
+int gyro_calibration_samples(double rate_hz)
+{
+    if (rate_hz <= 0)
+        return CALIBRATION_SAMPLES;
+    int samples = (int)lround(CALIBRATION_SECONDS * rate_hz);
+    if (samples < CALIBRATION_MIN_SAMPLES)
+        return CALIBRATION_MIN_SAMPLES;
+    return samples > CALIBRATION_SAMPLES ? CALIBRATION_SAMPLES : samples;
+}
+
+void gyro_calibration_reset(GyroCalibration *calibration)
+{
+    calibration->count = 0;
+    calibration->still = false;
+    for (int axis = 0; axis < 6; axis++)
+    {
+        calibration->mean[axis] = 0;
+        calibration->m2[axis]   = 0;
+    }
+    for (int axis = 0; axis < 3; axis++)
+        calibration->offset[axis] = 0;
+}
+
+/* Adds one sample, the gyro in raw register values and the accelerometer in raw register values */
+void gyro_calibration_add(GyroCalibration *calibration, double gyroX, double gyroY, double gyroZ,
+                          double accX, double accY, double accZ)
+{
+    double value[6] = { convert_to_deg_per_sec(gyroX), convert_to_deg_per_sec(gyroY), convert_to_deg_per_sec(gyroZ),
+                        convert_to_g(accX), convert_to_g(accY), convert_to_g(accZ) };
+    calibration->count++;
+    for (int axis = 0; axis < 6; axis++)
+    {
+        double delta = value[axis] - calibration->mean[axis];
+        calibration->mean[axis] += delta / calibration->count;
+        calibration->m2[axis]   += delta * (value[axis] - calibration->mean[axis]);
+    }
+}
+
+/* Decides whether the sensor was still, and if so sets the offsets. Returns the decision */
+bool gyro_calibration_finish(GyroCalibration *calibration)
+{
+    calibration->still = calibration->count > 1;
+    for (int axis = 0; axis < 6 && calibration->still; axis++)
+    {
+        double limit = axis < 3 ? STILL_MAX_GYRO_STDDEV : STILL_MAX_ACCEL_STDDEV;
+        if (calibration->m2[axis] / (calibration->count - 1) > limit * limit)
+            calibration->still = false;
+    }
+    for (int axis = 0; axis < 3; axis++)
+        calibration->offset[axis] = calibration->still ? calibration->mean[axis] : 0;
+    return calibration->still;
+}
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ Gyro bias as a function of the temperature, learned online and persisted across runs.
+
+ MEMS gyro offsets drift with the temperature. Per axis the model is a straight line,
+
+   bias(T) = offset + slope * (T - TEMP_MODEL_REFERENCE_C)
+
+ fitted by weighted least squares to observed (temperature, bias) pairs. Older pairs are
+ slowly forgotten, so the model follows the sensor as it ages. As long as the observed
+ temperatures are too close together to tell a slope, only the offset is fitted.
+
+ The model is subtracted from the rates before they reach the fusion engine, so the bias
+ state of the Kalman filter only has to track what the model does not explain, and does
+ not have to chase the bias through a warm-up.
+
+ While the estimate of the other axis is past ±90 degrees, the fusion engine negates the
+ rate of the restricted axis (max_90_deg_correction()), and its Kalman filter then learns
+ the negated bias. temp_model_learn() turns it back before it observes it.
+
+ The model file has one line per device and axis:
+
+   device axis weight sum_t sum_tt sum_b sum_tb
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _GyroTempModel_h
+#define _GyroTempModel_h
+
+#include "FusionEngine.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TEMP_MODEL_REFERENCE_C         25.0
+#define TEMP_MODEL_FORGETTING          0.9999 /* Per observation */
+#define TEMP_MODEL_MIN_SPREAD_C        2.0    /* Standard deviation of the observed temperatures needed to fit a slope */
+#define TEMP_MODEL_AXES                3
+#define TEMP_MODEL_UPDATE_SAMPLES      100    /* Samples between two observations of the Kalman bias */
+
+/* Weighted sums of the observations, with t the temperature relative to the reference and b the bias */
+struct GyroTempAxis {
+    double weight;
+    double sum_t;
+    double sum_tt;
+    double sum_b;
+    double sum_tb;
+    double offset; /* Degrees per second at the reference temperature */
+    double slope;  /* Degrees per second per degree C */
+};
+
+struct GyroTempModel {
+    GyroTempAxis axis[TEMP_MODEL_AXES];
+};
+
+void temp_model_fit(GyroTempAxis *axis)
+{
+    if (axis->weight <= 0)
+        return;
+    double mean_t   = axis->sum_t / axis->weight;
+    double mean_b   = axis->sum_b / axis->weight;
+    double var_t    = axis->sum_tt / axis->weight - mean_t * mean_t;
+    if (var_t > TEMP_MODEL_MIN_SPREAD_C * TEMP_MODEL_MIN_SPREAD_C)
+        axis->slope = (axis->sum_tb / axis->weight - mean_t * mean_b) / var_t;
+    axis->offset = mean_b - axis->slope * mean_t;
+}
+
+void temp_model_reset(GyroTempModel *model)
+{
+    memset(model, 0, sizeof(*model));
+}
+
+/* Bias of the axis in degrees per second at the temperature */
+double temp_model_bias(const GyroTempModel *model, int axis, double temp_degrees_c)
+{
+    const GyroTempAxis &a = model->axis[axis];
+    return a.offset + a.slope * (temp_degrees_c - TEMP_MODEL_REFERENCE_C);
+}
+
+/* Adds an observed bias in degrees per second at the temperature, with a weight of 1 for a normal observation */
+void temp_model_add(GyroTempModel *model, int axis, double temp_degrees_c, double bias, double weight)
+{
+    GyroTempAxis *a = &model->axis[axis];
+    double t = temp_degrees_c - TEMP_MODEL_REFERENCE_C;
+    a->weight = a->weight * TEMP_MODEL_FORGETTING + weight;
+    a->sum_t  = a->sum_t  * TEMP_MODEL_FORGETTING + weight * t;
+    a->sum_tt = a->sum_tt * TEMP_MODEL_FORGETTING + weight * t * t;
+    a->sum_b  = a->sum_b  * TEMP_MODEL_FORGETTING + weight * bias;
+    a->sum_tb = a->sum_tb * TEMP_MODEL_FORGETTING + weight * t * bias;
+    temp_model_fit(a);
+}
+
+/* Observes the bias that the Kalman filters learned on top of the model, and moves what the model now explains out of them */
+template <AngleConvention convention>
+void temp_model_learn(GyroTempModel *model, double temp_degrees_c, KalmanEngineIn<convention> &engine)
+{
+    Kalman *kalman[2] = { &engine.kalman_roll, &engine.kalman_pitch };
+    double roll, pitch;
+    engine.getAngles(&roll, &pitch);
+    /* The sign that the engine gave the rate of each axis, or 0 while the free axis is past
+       ±90 degrees, where the engine sets it from the accelerometer and its bias stands still */
+    double sign[2];
+    if (convention == PITCH_RESTRICTED)
+    {
+        sign[0] = abs(roll) > 90 ? 0 : 1;
+        sign[1] = max_90_deg_correction(1, roll);
+    }
+    else
+    {
+        sign[0] = max_90_deg_correction(1, pitch);
+        sign[1] = abs(pitch) > 90 ? 0 : 1;
+    }
+
+    for (int axis = 0; axis < 2; axis++)
+    {
+        if (sign[axis] == 0)
+            continue;
+        double before = temp_model_bias(model, axis, temp_degrees_c);
+        temp_model_add(model, axis, temp_degrees_c, before + sign[axis] * kalman[axis]->getBias(), 1);
+
+        /* So the sum stays the same */
+        double change = temp_model_bias(model, axis, temp_degrees_c) - before;
+        kalman[axis]->setBias(kalman[axis]->getBias() - sign[axis] * change);
+    }
+}
+
+bool temp_model_load(const char *path, const char *device, GyroTempModel *model)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+    char line[256];
+    char line_device[32];
+    int axis;
+    GyroTempAxis a;
+    bool found = false;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (sscanf(line, "%31s %d %lf %lf %lf %lf %lf", line_device, &axis,
+                   &a.weight, &a.sum_t, &a.sum_tt, &a.sum_b, &a.sum_tb) != 7)
+            continue;
+        if (strcmp(line_device, device) != 0 || axis < 0 || axis >= TEMP_MODEL_AXES)
+            continue;
+        a.offset = 0;
+        a.slope  = 0;
+        temp_model_fit(&a);
+        model->axis[axis] = a;
+        found = true;
+    }
+    fclose(file);
+    return found;
+}
+
+/* Writes the model of one device, the file is replaced atomically */
+bool temp_model_save(const char *path, const char *device, const GyroTempModel *model)
+{
+    char temporary_path[512];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+
+    FILE *file = fopen(temporary_path, "w");
+    if (!file)
+        return false;
+    fprintf(file, "# device axis weight sum_t sum_tt sum_b sum_tb (t in degrees C from %.1f, b in degrees per second)\n",
+            TEMP_MODEL_REFERENCE_C);
+    for (int axis = 0; axis < TEMP_MODEL_AXES; axis++)
+    {
+        const GyroTempAxis &a = model->axis[axis];
+        fprintf(file, "%s %d %.9g %.9g %.9g %.9g %.9g\n", device, axis, a.weight, a.sum_t, a.sum_tt, a.sum_b, a.sum_tb);
+    }
+    if (fclose(file) != 0)
+        return false;
+    return rename(temporary_path, path) == 0;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ The I2C bus to the MPU6050 through the i2c-dev driver of Linux, without wiringPi.
+
+ A bus in the sense of WiringPiBus.h (readReg8() and writeReg8()), for the tools that run
+ on any Linux board with the sensor on I2C. Each sensor has its own I2CDevBus, opened at
+ its address: an MPU6050 answers at 0x68, or at 0x69 with its AD0 pin high. readBlock()
+ reads registers from the first on in one burst, with a repeated start between the write
+ of the register and the read, so that the accel, temperature and gyro registers come
+ from the same sample and take a single transfer on the wire.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _I2CDevBus_h
+#define _I2CDevBus_h
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define I2C_DEV_DEFAULT_PATH           "/dev/i2c-1"  /* The bus on the header of a Raspberry Pi */
+
+class I2CDevBus {
+public:
+    I2CDevBus() { fd = -1; };
+    ~I2CDevBus() { close(); };
+
+    /* Opens the bus for the sensor at the address, false when there is no such bus */
+    bool open(const char *path, int device_address) {
+        close();
+        fd = ::open(path, O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        address = device_address;
+        return true;
+    };
+    bool isOpen() { return fd >= 0; };
+    void close() {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    };
+
+    /* -1 when the transfer fails, as wiringPiI2CReadReg8() */
+    int readReg8(int register_address) {
+        unsigned char value;
+        return readBlock(register_address, &value, 1) ? value : -1;
+    };
+    void writeReg8(int register_address, int value) {
+        unsigned char data[2] = { (unsigned char)register_address, (unsigned char)value };
+        struct i2c_msg message = { (__u16)address, 0, 2, data };
+        transfer(&message, 1);
+    };
+    /* Reads count registers from the first on, in one transfer */
+    bool readBlock(int register_address, unsigned char *data, int count) {
+        unsigned char first = (unsigned char)register_address;
+        struct i2c_msg messages[2] = {
+            { (__u16)address, 0, 1, &first },
+            { (__u16)address, I2C_M_RD, (__u16)count, data }
+        };
+        return transfer(messages, 2);
+    };
+
+private:
+    bool transfer(struct i2c_msg *messages, int count) {
+        struct i2c_rdwr_ioctl_data transfers = { messages, (__u32)count };
+        return fd >= 0 && ioctl(fd, I2C_RDWR, &transfers) == count;
+    };
+
+    int fd;
+    int address;
+};
+
+#endif
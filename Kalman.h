@@ -26,6 +26,15 @@ public:
         Q_bias = 0.003;
         R_measure = 0.03;
 
+        adaptive = false; // Use a constant measurement noise, see setAdaptive
+        R_accel = 400;
+        innovation_gate = 9;
+        accNorm = 1;
+
+        trapezoidal = false; // Integrate the rate with Euler, see setTrapezoidal
+        lastRate = 0;
+        hasLastRate = false;
+
         angle = 0; // Reset the angle
         bias = 0; // Reset bias
 
@@ -39,12 +48,28 @@ public:
         // KasBot V2  -  Kalman filter module - http://www.x-firm.com/?page_id=145
         // Modified by Kristian Lauszus
         // See my blog post for more information: http://blog.tkjelectronics.dk/2012/09/a-practical-approach-to-kalman-filter-and-how-to-implement-it
+        return getAngle(newAngle, newRate, dt, 1);
+    };
+    // As above, with the length of the acceleration vector in g that the angle was calculated from, used by the adaptive mode.
+    // Without it the length is taken as 1 g, not as the one given to an earlier call
+    double getAngle(double newAngle, double newRate, double dt, double newAccNorm) {
+        predict(newRate, dt);
+        return correct(newAngle, newAccNorm);
+    };
 
+    /* getAngle() in two halves, so that the gyro rate can be integrated at every sample and the angle measurement
+       only be used at a lower rate. The correction is the expensive half */
+    double predict(double newRate, double dt) {
         // Discrete Kalman filter time update equations - Time Update ("Predict")
         // Update xhat - Project the state ahead
         /* Step 1 */
         rate = newRate - bias;
-        angle += dt * rate;
+        if (trapezoidal && hasLastRate)
+            angle += dt * ((newRate + lastRate) / 2 - bias);
+        else
+            angle += dt * rate;
+        lastRate = newRate;
+        hasLastRate = true;
 
         // Update estimation error covariance - Project the error covariance ahead
         /* Step 2 */
@@ -53,17 +78,27 @@ public:
         P[1][0] -= dt * P[1][1];
         P[1][1] += Q_bias * dt;
 
+        return angle;
+    };
+    double correct(double newAngle) {
+        return correct(newAngle, 1);
+    };
+    double correct(double newAngle, double newAccNorm) {
+        accNorm = newAccNorm;
+
         // Discrete Kalman filter measurement update equations - Measurement Update ("Correct")
+        // Calculate angle difference - Innovation of the measurement zk (newAngle)
+        /* Step 3 */
+        y = newAngle - angle;
+
         // Calculate Kalman gain - Compute the Kalman gain
         /* Step 4 */
-        S = P[0][0] + R_measure;
+        S = P[0][0] + (adaptive ? adaptiveR() : R_measure);
         /* Step 5 */
         K[0] = P[0][0] / S;
         K[1] = P[1][0] / S;
 
         // Calculate angle and bias - Update estimate with measurement zk (newAngle)
-        /* Step 3 */
-        y = newAngle - angle;
         /* Step 6 */
         angle += K[0] * y;
         bias += K[1] * y;
@@ -77,8 +112,12 @@ public:
 
         return angle;
     };
-    void setAngle(double newAngle) { angle = newAngle; }; // Used to set angle, this should be set as the starting angle
+    void setAngle(double newAngle) { angle = newAngle; hasLastRate = false; }; // Used to set angle, this should be set as the starting angle. The next predict does not average with the rate from before it
     double getRate() { return rate; }; // Return the unbiased rate
+    double getBias() { return bias; }; // Return the estimated gyro bias
+    double getP(int row, int column) { return P[row][column]; }; // Return an element of the error covariance matrix
+    void setBias(double newBias) { bias = newBias; }; // Used to restore a converged bias, instead of learning it from 0
+    void setP(int row, int column, double newP) { P[row][column] = newP; }; // Used to restore a converged error covariance matrix
 
     /* These are used to tune the Kalman filter */
     void setQangle(double newQ_angle) { Q_angle = newQ_angle; };
@@ -89,16 +128,51 @@ public:
     double getQbias() { return Q_bias; };
     double getRmeasure() { return R_measure; };
 
+    /* In adaptive mode the measurement noise is raised for samples where the accelerometer angle can not be trusted:
+       when the acceleration is not 1 g (linear acceleration or vibration) and when the angle difference is far outside
+       what the estimate error allows for. It costs a few multiplications per update */
+    void setAdaptive(bool newAdaptive) { adaptive = newAdaptive; };
+    void setRaccel(double newR_accel) { R_accel = newR_accel; };
+    void setInnovationGate(double newInnovation_gate) { innovation_gate = newInnovation_gate; };
+
+    /* Integrate the mean of this and the previous rate instead of this rate only. Second order accurate, so the same
+       accuracy needs a lower sample rate. The error covariance is projected ahead the same way in both cases */
+    void setTrapezoidal(bool newTrapezoidal) { trapezoidal = newTrapezoidal; };
+    bool getTrapezoidal() { return trapezoidal; };
+
+    bool getAdaptive() { return adaptive; };
+    double getRaccel() { return R_accel; };
+    double getInnovationGate() { return innovation_gate; };
+
 private:
+    double adaptiveR() {
+        // Scale with the squared deviation of the acceleration from 1 g
+        double deviation = accNorm - 1;
+        double R = R_measure * (1 + R_accel * deviation * deviation);
+
+        // Raise R until the angle difference is within innovation_gate times the estimate error (y*y/S is 1 on average)
+        double gated = y * y / innovation_gate - P[0][0];
+        return gated > R ? gated : R;
+    };
+
     /* Kalman filter variables */
     double Q_angle; // Process noise variance for the accelerometer
     double Q_bias; // Process noise variance for the gyro bias
     double R_measure; // Measurement noise variance - this is actually the variance of the measurement noise
 
+    bool adaptive; // Scale the measurement noise per sample, see setAdaptive
+    double R_accel; // How fast the measurement noise grows with the deviation of the acceleration from 1 g
+    double innovation_gate; // Largest accepted angle difference squared relative to its expected variance
+    double accNorm; // Length of the acceleration vector in g, given to getAngle
+
     double angle; // The angle calculated by the Kalman filter - part of the 2x1 state vector
     double bias; // The gyro bias calculated by the Kalman filter - part of the 2x1 state vector
     double rate; // Unbiased rate calculated from the rate and the calculated bias - you have to call getAngle to update the rate
 
+    bool trapezoidal; // Integrate with the trapezoidal rule, see setTrapezoidal
+    double lastRate; // The rate given to the previous predict, with its bias
+    bool hasLastRate;
+
     double P[2][2]; // Error covariance matrix - This is a 2x2 matrix
     double K[2]; // Kalman gain - This is a 2x1 vector
     double y; // Angle difference
@@ -0,0 +1,106 @@
+/*
+ A bank of Kalman filters that all see the same samples but each have their own tuning.
+
+ The equations are exactly those of Kalman::getAngle() in Kalman.h, but the variables are
+ stored as one array per variable (structure of arrays) and every step is a plain loop over
+ the lanes, so the compiler vectorizes it with -O3 (SSE2 on x86-64, NEON on aarch64; 32-bit
+ ARM has no double lanes and runs it one lane after the other). Used to try many values of
+ Q_angle, Q_bias and R_measure on the same recorded data in one pass.
+
+ The axes are handled as KalmanEngine in FusionEngine.h handles them, so that the filter
+ that is tuned is the one that runs: when both the measured and the estimated angle are
+ past ±90 degrees, the estimate is set to the measurement, and bias and error covariance
+ are kept. The rate is given per lane, for the rate of the restricted axis that is negated
+ while the estimate of the other axis is past ±90 degrees (max_90_deg_correction()). Both
+ are a compare and a select per lane, no branch.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _KalmanBank_h
+#define _KalmanBank_h
+
+#include <math.h>
+
+template <int lanes>
+class KalmanBank {
+public:
+    KalmanBank() {
+        for (int i = 0; i < lanes; i++) {
+            Q_angle[i] = 0.001;
+            Q_bias[i] = 0.003;
+            R_measure[i] = 0.03;
+        }
+        setAngle(0);
+    };
+    // Sets the starting angle of all lanes and resets bias and error covariance like the Kalman constructor
+    void setAngle(double newAngle) {
+        for (int i = 0; i < lanes; i++) {
+            angle[i] = newAngle;
+            bias[i] = 0;
+            P00[i] = 0;
+            P01[i] = 0;
+            P10[i] = 0;
+            P11[i] = 0;
+        }
+    };
+    // The angle should be in degrees and the rate of each lane should be in degrees per second and the delta time in seconds
+    void getAngle(double newAngle, const double newRate[lanes], double dt) {
+        bool measured_past_90 = fabs(newAngle) > 90;
+        for (int i = 0; i < lanes; i++) {
+            bool reset = measured_past_90 && fabs(angle[i]) > 90;
+
+            /* Step 1 */
+            double predicted = angle[i] + dt * (newRate[i] - bias[i]);
+
+            /* Step 2 */
+            double p00 = P00[i] + dt * (dt*P11[i] - P01[i] - P10[i] + Q_angle[i]);
+            double p01 = P01[i] - dt * P11[i];
+            double p10 = P10[i] - dt * P11[i];
+            double p11 = P11[i] + Q_bias[i] * dt;
+
+            /* Step 3 */
+            double y = newAngle - predicted;
+            /* Step 4 */
+            double S = p00 + R_measure[i];
+            /* Step 5 */
+            double K0 = p00 / S;
+            double K1 = p10 / S;
+
+            /* Step 6 */
+            double corrected = predicted + K0 * y;
+            double new_bias  = bias[i] + K1 * y;
+
+            /* Step 7 */
+            p00 -= K0 * p00;
+            p01 -= K0 * p01;
+            p10 -= K1 * p00;
+            p11 -= K1 * p01;
+
+            angle[i] = reset ? newAngle : corrected;
+            bias[i]  = reset ? bias[i] : new_bias;
+            P00[i]   = reset ? P00[i] : p00;
+            P01[i]   = reset ? P01[i] : p01;
+            P10[i]   = reset ? P10[i] : p10;
+            P11[i]   = reset ? P11[i] : p11;
+        }
+    };
+    const double *getAngles() { return angle; };
+
+    /* Tuning per lane */
+    double Q_angle[lanes];
+    double Q_bias[lanes];
+    double R_measure[lanes];
+
+private:
+    double angle[lanes];
+    double bias[lanes];
+    double P00[lanes], P01[lanes], P10[lanes], P11[lanes];
+};
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ Rauch-Tung-Striebel (RTS) fixed-interval smoother for one axis of the Kalman filter.
+
+ The forward pass is the Kalman class itself, so the smoothed result belongs to exactly
+ the same model and tuning as the causal getAngle() output. For every step the predicted
+ state and error covariance and the updated state and error covariance are stored, and a
+ backward pass then combines them into the best estimate given all the samples, past and
+ future. This can only be done offline, on recorded captures.
+
+ The model is the one in Kalman.h: the state is [angle, bias], the rate is the input and
+
+   F = | 1  -dt |      Q = | Q_angle*dt      0     |
+       | 0   1  |          |     0       Q_bias*dt |
+
+ The measured angles are unwrapped against the estimate before they are fed to the
+ filter, so an axis passing ±180 degrees does not need a setAngle() reset, which would
+ break the backward pass. The smoothed angles are wrapped back to ±180 degrees.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _KalmanSmoother_h
+#define _KalmanSmoother_h
+
+#include "Kalman.h"
+#include <math.h>
+#include <vector>
+
+class KalmanSmoother {
+public:
+    KalmanSmoother() {
+        /* Same tuning as a default constructed Kalman, these can also be tuned by the user */
+        Kalman defaults;
+        Q_angle = defaults.getQangle();
+        Q_bias = defaults.getQbias();
+        R_measure = defaults.getRmeasure();
+    };
+    // The angles should be in degrees, the rates in degrees per second and the delta times in seconds.
+    // Smooths count samples and writes the smoothed angles to smoothed_angle, which may be one of the inputs.
+    void smooth(const double *newAngle, const double *newRate, const double *dt, int count, double *smoothed_angle) {
+        if (count <= 0)
+            return;
+        predicted.resize(count);
+        updated.resize(count);
+
+        // Forward pass
+        Kalman kalman;
+        kalman.setQangle(Q_angle);
+        kalman.setQbias(Q_bias);
+        kalman.setRmeasure(R_measure);
+        kalman.setAngle(newAngle[0]);
+
+        Step previous = { newAngle[0], 0, { { 0, 0 }, { 0, 0 } } };
+        predicted[0] = previous;
+        updated[0] = previous;
+        for (int i = 1; i < count; i++) {
+            // The prediction Kalman::getAngle() makes internally
+            Step &prior = predicted[i];
+            prior.angle = previous.angle + dt[i] * (newRate[i] - previous.bias);
+            prior.bias = previous.bias;
+            prior.P[0][0] = previous.P[0][0] + dt[i] * (dt[i]*previous.P[1][1] - previous.P[0][1] - previous.P[1][0] + Q_angle);
+            prior.P[0][1] = previous.P[0][1] - dt[i] * previous.P[1][1];
+            prior.P[1][0] = previous.P[1][0] - dt[i] * previous.P[1][1];
+            prior.P[1][1] = previous.P[1][1] + Q_bias * dt[i];
+
+            double measurement = prior.angle + wrap_180(newAngle[i] - prior.angle);
+            Step &posterior = updated[i];
+            posterior.angle = kalman.getAngle(measurement, newRate[i], dt[i]);
+            posterior.bias = kalman.getBias();
+            for (int row = 0; row < 2; row++)
+                for (int column = 0; column < 2; column++)
+                    posterior.P[row][column] = kalman.getP(row, column);
+            previous = posterior;
+        }
+
+        // Backward pass
+        double angle = updated[count-1].angle;
+        double bias = updated[count-1].bias;
+        smoothed_angle[count-1] = wrap_180(angle);
+        for (int i = count - 2; i >= 0; i--) {
+            const Step &posterior = updated[i];
+            const Step &prior = predicted[i+1];
+
+            // C = P(i|i) * F' * inverse(P(i+1|i))
+            double PF[2][2] = {
+                { posterior.P[0][0] - dt[i+1] * posterior.P[0][1], posterior.P[0][1] },
+                { posterior.P[1][0] - dt[i+1] * posterior.P[1][1], posterior.P[1][1] }
+            };
+            double det = prior.P[0][0] * prior.P[1][1] - prior.P[0][1] * prior.P[1][0];
+            double C[2][2] = { { 0, 0 }, { 0, 0 } };
+            if (fabs(det) > 1e-18) {
+                C[0][0] = ( PF[0][0] * prior.P[1][1] - PF[0][1] * prior.P[1][0]) / det;
+                C[0][1] = (-PF[0][0] * prior.P[0][1] + PF[0][1] * prior.P[0][0]) / det;
+                C[1][0] = ( PF[1][0] * prior.P[1][1] - PF[1][1] * prior.P[1][0]) / det;
+                C[1][1] = (-PF[1][0] * prior.P[0][1] + PF[1][1] * prior.P[0][0]) / det;
+            }
+
+            double angle_difference = angle - prior.angle;
+            double bias_difference = bias - prior.bias;
+            angle = posterior.angle + C[0][0] * angle_difference + C[0][1] * bias_difference;
+            bias = posterior.bias + C[1][0] * angle_difference + C[1][1] * bias_difference;
+            smoothed_angle[i] = wrap_180(angle);
+        }
+    };
+
+    /* These are used to tune the smoother, in the same way as the Kalman filter */
+    void setQangle(double newQ_angle) { Q_angle = newQ_angle; };
+    void setQbias(double newQ_bias) { Q_bias = newQ_bias; };
+    void setRmeasure(double newR_measure) { R_measure = newR_measure; };
+
+    double getQangle() { return Q_angle; };
+    double getQbias() { return Q_bias; };
+    double getRmeasure() { return R_measure; };
+
+private:
+    struct Step {
+        double angle;
+        double bias;
+        double P[2][2];
+    };
+
+    static double wrap_180(double angle) {
+        return angle - 360.0 * floor((angle + 180.0) / 360.0);
+    };
+
+    double Q_angle;
+    double Q_bias;
+    double R_measure;
+
+    std::vector<Step> predicted; // Predicted state and error covariance per step
+    std::vector<Step> updated;   // Updated state and error covariance per step
+};
+
+#endif
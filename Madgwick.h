@@ -0,0 +1,111 @@
+/* Madgwick gradient descent orientation filter for a 6-axis IMU (gyro + accelerometer).
+
+ Based on the IMU variant of the algorithm described in:
+ S. O. H. Madgwick, "An efficient orientation filter for inertial and inertial/magnetic
+ sensor arrays", 2010.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _Madgwick_h
+#define _Madgwick_h
+
+#include <math.h>
+
+class Madgwick {
+public:
+    Madgwick() {
+        /* We will set the variables like so, these can also be tuned by the user */
+        beta = 0.1;
+
+        q0 = 1; // Start with the identity quaternion, use setAngle to set the starting attitude
+        q1 = 0;
+        q2 = 0;
+        q3 = 0;
+    };
+    // The rates should be in degrees per second, the accelerometer in any unit and the delta time in seconds
+    void update(double gx, double gy, double gz, double ax, double ay, double az, double dt) {
+        gx *= M_PI / 180.0;
+        gy *= M_PI / 180.0;
+        gz *= M_PI / 180.0;
+
+        // Rate of change of quaternion from gyroscope
+        double qDot0 = 0.5 * (-q1 * gx - q2 * gy - q3 * gz);
+        double qDot1 = 0.5 * ( q0 * gx + q2 * gz - q3 * gy);
+        double qDot2 = 0.5 * ( q0 * gy - q1 * gz + q3 * gx);
+        double qDot3 = 0.5 * ( q0 * gz + q1 * gy - q2 * gx);
+
+        // Only correct when the accelerometer measurement is valid (avoids NaN in normalisation)
+        double norm = sqrt(ax * ax + ay * ay + az * az);
+        if (norm > 0) {
+            ax /= norm;
+            ay /= norm;
+            az /= norm;
+
+            // Gradient descent corrective step
+            double f0 = 2 * (q1 * q3 - q0 * q2) - ax;
+            double f1 = 2 * (q0 * q1 + q2 * q3) - ay;
+            double f2 = 2 * (0.5 - q1 * q1 - q2 * q2) - az;
+
+            double s0 = -2 * q2 * f0 + 2 * q1 * f1;
+            double s1 =  2 * q3 * f0 + 2 * q0 * f1 - 4 * q1 * f2;
+            double s2 = -2 * q0 * f0 + 2 * q3 * f1 - 4 * q2 * f2;
+            double s3 =  2 * q1 * f0 + 2 * q2 * f1;
+
+            norm = sqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);
+            if (norm > 0) {
+                qDot0 -= beta * s0 / norm;
+                qDot1 -= beta * s1 / norm;
+                qDot2 -= beta * s2 / norm;
+                qDot3 -= beta * s3 / norm;
+            }
+        }
+
+        // Integrate rate of change of quaternion
+        q0 += qDot0 * dt;
+        q1 += qDot1 * dt;
+        q2 += qDot2 * dt;
+        q3 += qDot3 * dt;
+
+        normalize();
+    };
+    // Used to set the starting attitude in degrees, roll about x and pitch about y (yaw is set to 0)
+    void setAngle(double roll, double pitch) {
+        double cr = cos(roll * M_PI / 360.0), sr = sin(roll * M_PI / 360.0);
+        double cp = cos(pitch * M_PI / 360.0), sp = sin(pitch * M_PI / 360.0);
+        q0 =  cr * cp;
+        q1 =  sr * cp;
+        q2 =  cr * sp;
+        q3 = -sr * sp;
+    };
+
+    /* Gravity direction in the sensor frame, as the accelerometer would see it when at rest */
+    double getGravityX() { return 2 * (q1 * q3 - q0 * q2); };
+    double getGravityY() { return 2 * (q0 * q1 + q2 * q3); };
+    double getGravityZ() { return q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3; };
+
+    /* These are used to tune the Madgwick filter */
+    void setBeta(double newBeta) { beta = newBeta; };
+    double getBeta() { return beta; };
+
+private:
+    void normalize() {
+        double norm = sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+        q0 /= norm;
+        q1 /= norm;
+        q2 /= norm;
+        q3 /= norm;
+    };
+
+    /* Madgwick filter variables */
+    double beta; // Gradient descent step size - how strongly the accelerometer pulls the gyro integration
+
+    double q0, q1, q2, q3; // Orientation quaternion from the sensor frame to the earth frame
+};
+
+#endif
@@ -0,0 +1,116 @@
+/* Mahony nonlinear complementary (PI) orientation filter for a 6-axis IMU (gyro + accelerometer).
+
+ Based on the explicit complementary filter described in:
+ R. Mahony, T. Hamel and J.-M. Pflimlin, "Nonlinear Complementary Filters on the
+ Special Orthogonal Group", IEEE Transactions on Automatic Control, 2008.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _Mahony_h
+#define _Mahony_h
+
+#include <math.h>
+
+class Mahony {
+public:
+    Mahony() {
+        /* We will set the variables like so, these can also be tuned by the user */
+        Kp = 1.0;
+        Ki = 0.05;
+
+        q0 = 1; // Start with the identity quaternion, use setAngle to set the starting attitude
+        q1 = 0;
+        q2 = 0;
+        q3 = 0;
+
+        integralX = 0; // Reset the integral term, it converges to the gyro bias
+        integralY = 0;
+        integralZ = 0;
+    };
+    // The rates should be in degrees per second, the accelerometer in any unit and the delta time in seconds
+    void update(double gx, double gy, double gz, double ax, double ay, double az, double dt) {
+        gx *= M_PI / 180.0;
+        gy *= M_PI / 180.0;
+        gz *= M_PI / 180.0;
+
+        // Only correct when the accelerometer measurement is valid (avoids NaN in normalisation)
+        double norm = sqrt(ax * ax + ay * ay + az * az);
+        if (norm > 0) {
+            ax /= norm;
+            ay /= norm;
+            az /= norm;
+
+            // Estimated direction of gravity
+            double vx = 2 * (q1 * q3 - q0 * q2);
+            double vy = 2 * (q0 * q1 + q2 * q3);
+            double vz = q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+
+            // Error is the cross product between estimated and measured direction of gravity
+            double ex = ay * vz - az * vy;
+            double ey = az * vx - ax * vz;
+            double ez = ax * vy - ay * vx;
+
+            // Integral feedback (learns the gyro bias), followed by proportional feedback
+            integralX += Ki * ex * dt;
+            integralY += Ki * ey * dt;
+            integralZ += Ki * ez * dt;
+            gx += Kp * ex + integralX;
+            gy += Kp * ey + integralY;
+            gz += Kp * ez + integralZ;
+        }
+
+        // Integrate rate of change of quaternion
+        double qa = q0, qb = q1, qc = q2;
+        q0 += 0.5 * dt * (-qb * gx - qc * gy - q3 * gz);
+        q1 += 0.5 * dt * ( qa * gx + qc * gz - q3 * gy);
+        q2 += 0.5 * dt * ( qa * gy - qb * gz + q3 * gx);
+        q3 += 0.5 * dt * ( qa * gz + qb * gy - qc * gx);
+
+        normalize();
+    };
+    // Used to set the starting attitude in degrees, roll about x and pitch about y (yaw is set to 0)
+    void setAngle(double roll, double pitch) {
+        double cr = cos(roll * M_PI / 360.0), sr = sin(roll * M_PI / 360.0);
+        double cp = cos(pitch * M_PI / 360.0), sp = sin(pitch * M_PI / 360.0);
+        q0 =  cr * cp;
+        q1 =  sr * cp;
+        q2 =  cr * sp;
+        q3 = -sr * sp;
+    };
+
+    /* Gravity direction in the sensor frame, as the accelerometer would see it when at rest */
+    double getGravityX() { return 2 * (q1 * q3 - q0 * q2); };
+    double getGravityY() { return 2 * (q0 * q1 + q2 * q3); };
+    double getGravityZ() { return q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3; };
+
+    /* These are used to tune the Mahony filter */
+    void setKp(double newKp) { Kp = newKp; };
+    void setKi(double newKi) { Ki = newKi; };
+
+    double getKp() { return Kp; };
+    double getKi() { return Ki; };
+
+private:
+    void normalize() {
+        double norm = sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+        q0 /= norm;
+        q1 /= norm;
+        q2 /= norm;
+        q3 /= norm;
+    };
+
+    /* Mahony filter variables */
+    double Kp; // Proportional gain - how strongly the accelerometer pulls the gyro integration
+    double Ki; // Integral gain - how fast the gyro bias is learned
+
+    double q0, q1, q2, q3; // Orientation quaternion from the sensor frame to the earth frame
+    double integralX, integralY, integralZ; // Integral of the error in rad/s - the learned gyro bias correction
+};
+
+#endif
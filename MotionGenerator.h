@@ -0,0 +1,231 @@
+/*
+ Synthetic motion with known attitude, turned into the raw samples the MPU6050 would give.
+
+ A scenario is a trajectory of roll and pitch over time, with the linear acceleration the
+ sensor feels on top of gravity:
+
+   static     lying still at a small tilt
+   tilt       slow tilting of roll and pitch, as when the board is turned by hand
+   vibration  a small tilt with motor-like vibration, linear at 25 and 40 Hz and
+              angular at 25 Hz
+   impacts    slow tilting with a short knock every 2 seconds, peaks of 6 g that
+              saturate the accelerometer at ±2 g
+   spin       roll turning over and over at 120 degrees per second, past ±90 and ±180,
+              while pitch swings
+   inverted   turned upside down over roll for half of every 20 seconds, held there, and
+              turned back, while pitch swings slowly
+
+ The body rates follow from the rates of the angles (zero yaw), and the samples are made
+ by the simulated register file of SimulatedMpu6050.h from the gravity plus linear
+ acceleration and the body rates, so they have the quantization, the saturation at the
+ selected full-scale ranges and the noise of the sensor. The sensor model adds a gyro
+ bias, and a temperature drift of that bias, while the temperature ramps from start to
+ end. The values are scaled to LSB of the default ranges, as the program captures them
+ (Capture.h), and the true angles are in the convention with pitch restricted to ±90
+ degrees. The same scenario and model always give the same samples.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _MotionGenerator_h
+#define _MotionGenerator_h
+
+#include "Capture.h"
+#include "FullScaleRange.h"
+#include "SimulatedMpu6050.h"
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#define MOTION_RATE_STEP_SECONDS       1e-4  /* For the rates of the angles, by central differences */
+#define IMPACT_INTERVAL_SECONDS        2.0
+#define IMPACT_SECONDS                 0.01
+#define IMPACT_PEAK_G                  6.0
+#define INVERTED_PERIOD_SECONDS        20.0
+#define INVERTED_TURN_SECONDS          2.0
+
+enum MotionScenario {
+    MOTION_STATIC,
+    MOTION_TILT,
+    MOTION_VIBRATION,
+    MOTION_IMPACTS,
+    MOTION_SPIN,
+    MOTION_INVERTED,
+    MOTION_SCENARIO_COUNT
+};
+
+const char *motion_scenario_names[MOTION_SCENARIO_COUNT] = { "static", "tilt", "vibration", "impacts", "spin", "inverted" };
+
+/* The imperfections of the sensor and its settings */
+struct SensorModel {
+    double gyro_bias_deg_per_sec[3];
+    double gyro_drift_deg_per_sec_per_c; /* Change of the gyro bias with the temperature, on all axes */
+    double gyro_noise_deg_per_sec;       /* Standard deviation per sample */
+    double accel_noise_g;
+    double temp_start_c;
+    double temp_end_c;
+    int    gyro_range_deg_per_sec;       /* Full-scale ranges, the samples saturate at these */
+    int    accel_range_g;
+    double rate_hz;
+};
+
+/* A typical MPU6050 at its default ranges, warming up a little */
+void sensor_model_default(SensorModel *model)
+{
+    model->gyro_bias_deg_per_sec[0]     = 0.8;
+    model->gyro_bias_deg_per_sec[1]     = -0.4;
+    model->gyro_bias_deg_per_sec[2]     = 0.3;
+    model->gyro_drift_deg_per_sec_per_c = 0.02;
+    model->gyro_noise_deg_per_sec       = 0.05;
+    model->accel_noise_g                = 0.005;
+    model->temp_start_c                 = 25;
+    model->temp_end_c                   = 35;
+    model->gyro_range_deg_per_sec       = 250;
+    model->accel_range_g                = 2;
+    model->rate_hz                      = 200;
+}
+
+/* Returns the scenario with the given name, or MOTION_SCENARIO_COUNT if there is none */
+MotionScenario motion_scenario_from_name(const char *name)
+{
+    for (int i = 0; i < MOTION_SCENARIO_COUNT; i++)
+        if (strcmp(name, motion_scenario_names[i]) == 0)
+            return (MotionScenario)i;
+    return MOTION_SCENARIO_COUNT;
+}
+
+/* Roll and pitch in degrees at time t, roll continuous (not wrapped) */
+void motion_angles(MotionScenario scenario, double t, double *roll, double *pitch)
+{
+    switch (scenario)
+    {
+    case MOTION_STATIC:
+        *roll  = 10;
+        *pitch = -5;
+        break;
+    case MOTION_VIBRATION:
+        *roll  = 5 * sin(2 * M_PI * 0.2 * t) + 0.5 * sin(2 * M_PI * 25 * t);
+        *pitch = 3 * sin(2 * M_PI * 0.15 * t) + 0.3 * sin(2 * M_PI * 25 * t + 1);
+        break;
+    case MOTION_SPIN:
+        *roll  = 120 * t;
+        *pitch = 20 * sin(2 * M_PI * 0.3 * t);
+        break;
+    case MOTION_INVERTED:
+    {
+        /* Upright, turning over, upside down and turning back, in equal halves */
+        double phase = fmod(t, INVERTED_PERIOD_SECONDS);
+        double hold  = INVERTED_PERIOD_SECONDS / 2 - INVERTED_TURN_SECONDS;
+        if (phase < hold)
+            *roll = 0;
+        else if (phase < INVERTED_PERIOD_SECONDS / 2)
+            *roll = 90 * (1 - cos(M_PI * (phase - hold) / INVERTED_TURN_SECONDS));
+        else if (phase < INVERTED_PERIOD_SECONDS - INVERTED_TURN_SECONDS)
+            *roll = 180;
+        else
+            *roll = 90 * (1 + cos(M_PI * (phase - INVERTED_PERIOD_SECONDS + INVERTED_TURN_SECONDS) / INVERTED_TURN_SECONDS));
+        /* At its extremes in the middle of the turns, as the engine takes the gyro Y rate for the pitch rate */
+        *pitch = 10 * cos(2 * M_PI * (t - hold - INVERTED_TURN_SECONDS / 2) / INVERTED_PERIOD_SECONDS);
+        break;
+    }
+    default: /* MOTION_TILT and MOTION_IMPACTS */
+        *roll  = 30 * sin(2 * M_PI * 0.1 * t);
+        *pitch = 20 * sin(2 * M_PI * 0.07 * t + 1);
+        break;
+    }
+}
+
+/* Linear acceleration in g in the sensor frame at time t, on top of gravity */
+void motion_linear_acceleration(MotionScenario scenario, double t, double acc_g[3])
+{
+    acc_g[0] = 0;
+    acc_g[1] = 0;
+    acc_g[2] = 0;
+    if (scenario == MOTION_VIBRATION)
+    {
+        acc_g[0] = 0.3 * sin(2 * M_PI * 25 * t);
+        acc_g[2] = 0.2 * sin(2 * M_PI * 40 * t);
+    }
+    else if (scenario == MOTION_IMPACTS)
+    {
+        double since_impact = fmod(t, IMPACT_INTERVAL_SECONDS) - IMPACT_INTERVAL_SECONDS / 2;
+        if (since_impact >= 0 && since_impact < IMPACT_SECONDS)
+        {
+            double pulse = IMPACT_PEAK_G * sin(M_PI * since_impact / IMPACT_SECONDS);
+            acc_g[0] = pulse;
+            acc_g[2] = -0.5 * pulse;
+        }
+    }
+}
+
+/* Wraps an angle to ±180 degrees */
+double motion_wrap_degrees(double angle)
+{
+    return angle - 360 * floor((angle + 180) / 360);
+}
+
+/* Makes the samples of the scenario for the duration, replacing the records */
+void motion_generate(MotionScenario scenario, const SensorModel &model, double seconds, std::vector<CaptureRecord> *records)
+{
+    SimulatedMpu6050 sensor;
+    sensor.writeReg8(REGISTER_FOR_POWER_MANAGEMENT, SLEEP_MODE_DISABLED);
+    int gyro_full_scale  = full_scale_from_range(gyro_ranges_deg_per_sec, model.gyro_range_deg_per_sec);
+    int accel_full_scale = full_scale_from_range(accel_ranges_g, model.accel_range_g);
+    FullScaleRange range;
+    range_configure(sensor, &range, gyro_full_scale < 0 ? 0 : gyro_full_scale, accel_full_scale < 0 ? 0 : accel_full_scale, false);
+    sensor.gyro_noise_deg_per_sec = model.gyro_noise_deg_per_sec;
+    sensor.accel_noise_g          = model.accel_noise_g;
+
+    records->clear();
+    int count = (int)(seconds * model.rate_hz);
+    for (int i = 0; i < count; i++)
+    {
+        double t = i / model.rate_hz;
+        double roll, pitch, roll_before, pitch_before, roll_after, pitch_after;
+        motion_angles(scenario, t, &roll, &pitch);
+        motion_angles(scenario, t - MOTION_RATE_STEP_SECONDS, &roll_before, &pitch_before);
+        motion_angles(scenario, t + MOTION_RATE_STEP_SECONDS, &roll_after, &pitch_after);
+        double roll_rate  = (roll_after - roll_before) / (2 * MOTION_RATE_STEP_SECONDS);
+        double pitch_rate = (pitch_after - pitch_before) / (2 * MOTION_RATE_STEP_SECONDS);
+
+        /* Gravity in the sensor frame, and the body rates for zero yaw */
+        double sin_roll  = sin(roll / RAD_TO_DEG);
+        double cos_roll  = cos(roll / RAD_TO_DEG);
+        double sin_pitch = sin(pitch / RAD_TO_DEG);
+        double cos_pitch = cos(pitch / RAD_TO_DEG);
+        double linear[3];
+        motion_linear_acceleration(scenario, t, linear);
+        sensor.acc_g[0]            = -sin_pitch + linear[0];
+        sensor.acc_g[1]            = sin_roll * cos_pitch + linear[1];
+        sensor.acc_g[2]            = cos_roll * cos_pitch + linear[2];
+        sensor.rate_deg_per_sec[0] = roll_rate;
+        sensor.rate_deg_per_sec[1] = pitch_rate * cos_roll;
+        sensor.rate_deg_per_sec[2] = -pitch_rate * sin_roll;
+
+        sensor.temp_degrees_c = model.temp_start_c + (model.temp_end_c - model.temp_start_c) * i / count;
+        for (int axis = 0; axis < 3; axis++)
+            sensor.gyro_bias_deg_per_sec[axis] = model.gyro_bias_deg_per_sec[axis]
+                + model.gyro_drift_deg_per_sec_per_c * (sensor.temp_degrees_c - model.temp_start_c);
+
+        CaptureRecord record;
+        record.t_us       = t * 1000000;
+        record.accX       = (int)(read_word_2c(sensor, REGISTER_FOR_ACCEL_XOUT_H) * range.accel.factor);
+        record.accY       = (int)(read_word_2c(sensor, REGISTER_FOR_ACCEL_YOUT_H) * range.accel.factor);
+        record.accZ       = (int)(read_word_2c(sensor, REGISTER_FOR_ACCEL_ZOUT_H) * range.accel.factor);
+        record.gyroX      = (int)(read_word_2c(sensor, REGISTER_FOR_GYRO_XOUT_H) * range.gyro.factor);
+        record.gyroY      = (int)(read_word_2c(sensor, REGISTER_FOR_GYRO_YOUT_H) * range.gyro.factor);
+        record.gyroZ      = (int)(read_word_2c(sensor, REGISTER_FOR_GYRO_ZOUT_H) * range.gyro.factor);
+        record.temp_raw   = read_word_2c(sensor, REGISTER_FOR_TEMP_OUT_H);
+        record.has_truth  = true;
+        record.roll_true  = motion_wrap_degrees(roll);
+        record.pitch_true = pitch;
+        records->push_back(record);
+    }
+}
+
+#endif
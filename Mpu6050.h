@@ -0,0 +1,150 @@
+/*
+ MPU6050 register map and the conversions from raw register values to rates and angles.
+
+ Shared by the demonstration program and the tools, so that they all compute the
+ angles in exactly the same way.
+
+ Source for equations and mathematical stuff used:
+ http://www.freescale.com/files/sensors/doc/app_note/AN3461.pdf
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _Mpu6050_h
+#define _Mpu6050_h
+
+#include <math.h>
+#include <stdlib.h>
+#include "FastAtan.h"
+
+/* MPU6050 */
+#define MPU6050_I2C_DEVICE_ADDRESS     0x68
+#define MPU6050_DEVICE_NAME            "mpu6050@0x68"  /* Key of the sensor in the state, model and offsets files */
+#define REGISTER_FOR_POWER_MANAGEMENT  0x6B  /* PWR_MGMT_1 */
+#define REGISTER_FOR_SAMPLE_RATE       0x19  /* SMPLRT_DIV */
+#define REGISTER_FOR_CONFIG            0x1A  /* DLPF_CFG in bits 2 to 0 */
+#define REGISTER_FOR_GYRO_CONFIG       0x1B  /* FS_SEL in bits 4 and 3 */
+#define REGISTER_FOR_ACCEL_CONFIG      0x1C  /* AFS_SEL in bits 4 and 3 */
+#define REGISTER_FOR_ACCEL_XOUT_H      0x3B
+#define REGISTER_FOR_ACCEL_YOUT_H      0x3D
+#define REGISTER_FOR_ACCEL_ZOUT_H      0x3F
+#define REGISTER_FOR_GYRO_XOUT_H       0x43
+#define REGISTER_FOR_GYRO_YOUT_H       0x45
+#define REGISTER_FOR_GYRO_ZOUT_H       0x47
+#define REGISTER_FOR_TEMP_OUT_H        0x41
+#define REGISTER_FOR_INT_ENABLE        0x38
+#define REGISTER_FOR_INT_STATUS        0x3A
+#define REGISTER_FOR_WHO_AM_I          0x75
+#define REGISTER_FOR_XA_OFFS_H         0x06  /* Accel offsets, X, Y and Z follow each other */
+#define REGISTER_FOR_XG_OFFS_USRH      0x13  /* Gyro offsets, X, Y and Z follow each other */
+#define SLEEP_MODE_DISABLED            0x00
+#define DATA_READY                     0x01  /* DATA_RDY_EN in INT_ENABLE and DATA_RDY_INT in INT_STATUS */
+
+/* Sensitivity at the default full-scale ranges of ±250 degrees per second and ±2 g. Each step up
+   of FS_SEL or AFS_SEL doubles the range and halves the sensitivity */
+#define GYRO_LSB_PER_DEG_PER_SEC       131.0
+#define ACCEL_LSB_PER_G                16384.0
+#define FULL_SCALE_SHIFT               3     /* Position of FS_SEL and AFS_SEL in their config registers */
+
+/* The offset registers have a fixed scale, independent of the full-scale range: ±16 g and ±1000 degrees per second */
+#define ACCEL_OFFSET_LSB_PER_G         2048.0
+#define GYRO_OFFSET_LSB_PER_DEG_PER_SEC 32.8
+
+/* Different math constants */
+#define RAD_TO_DEG                     (180.0 / M_PI)
+#define DRIFT_MAX_DEGREES              180
+
+/* Reads a 16 bit two's complement register pair, high byte first, from any bus with readReg8() */
+template <class Bus>
+int read_word_2c(Bus &bus, int register_h)
+{
+    int val;
+    val = bus.readReg8(register_h);
+    val = val << 8;
+    val += bus.readReg8(register_h+1);
+    if (val >= 0x8000)
+        val = -(65536 - val);
+    return val;
+}
+
+template <class Bus>
+void write_word_2c(Bus &bus, int register_h, int val)
+{
+    if (val < 0)
+        val += 65536;
+    bus.writeReg8(register_h, (val >> 8) & 0xFF);
+    bus.writeReg8(register_h+1, val & 0xFF);
+}
+
+/* The values are in LSB of the default ranges, the multiplications use precomputed reciprocals */
+double convert_to_deg_per_sec(double a)
+{
+    return a * (1.0 / GYRO_LSB_PER_DEG_PER_SEC);
+}
+
+double convert_to_g(double a)
+{
+    return a * (1.0 / ACCEL_LSB_PER_G);
+}
+
+double convert_to_degrees_c(double temp_raw)
+{
+    return (temp_raw / 340.0) + 36.53;
+}
+
+double distance(double a, double b)
+{
+    return sqrt((a*a) + (b*b));
+}
+
+/* With FAST_ATAN defined before this file is included, the angles use the polynomials of FastAtan.h instead of libm */
+double atan2_deg(double a, double b)
+{
+#ifdef FAST_ATAN
+    return fast_atan2_deg(a, b);
+#else
+    return atan2(a,b) * RAD_TO_DEG;
+#endif
+}
+
+double atan_deg(double a, double b, double c)
+{
+#ifdef FAST_ATAN
+    return fast_atan_deg(a, b, c);
+#else
+    return atan(a / distance(b, c)) * RAD_TO_DEG;
+#endif
+}
+
+/* atan(a / distance) in degrees, for callers that share the distance between angles. Same as atan_deg() */
+double atan_deg_of_distance(double a, double distance)
+{
+#ifdef FAST_ATAN
+    return fast_atan2_deg(a, distance);
+#else
+    return atan(a / distance) * RAD_TO_DEG;
+#endif
+}
+
+double max_drift_correction(double gyro, double kalman)
+{
+    if (gyro < -DRIFT_MAX_DEGREES || gyro > DRIFT_MAX_DEGREES)
+        return kalman;
+    else
+        return gyro;
+}
+
+double max_90_deg_correction(double rate, double kalman)
+{
+    if (abs(kalman) > 90)
+        return -rate;
+    else
+        return rate;
+}
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ Calibration of the MPU6050 offset registers (XA_OFFS/YA_OFFS/ZA_OFFS and XG_OFFS_USR...).
+
+ The sensor adds the offset registers to every sample itself, so once they are
+ programmed the raw values from read_word_2c() arrive corrected and the host does no
+ correction work per sample. The registers are volatile, so the calibration is saved to
+ a file and written to the sensor again at every startup.
+
+ The calibration runs at the default full-scale ranges and needs the sensor lying flat and
+ still, Z axis up. It measures the mean
+ of every axis, moves the offset registers by the error and repeats, since the steps of
+ the offset registers are coarser than the raw values and the first estimate is noisy.
+
+ The offsets file has one line: device xa ya za xg yg zg, with the register values.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _OffsetCalibration_h
+#define _OffsetCalibration_h
+
+#include "Mpu6050.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define OFFSET_CALIBRATION_SAMPLES     500
+#define OFFSET_CALIBRATION_ITERATIONS  4
+#define OFFSET_ACCEL_TOLERANCE         16.0  /* Raw LSB, about 1 mg */
+#define OFFSET_GYRO_TOLERANCE          8.0   /* Raw LSB, about 0.06 degrees per second */
+
+/* The six offset registers, accel X, Y, Z and gyro X, Y, Z */
+struct SensorOffsets {
+    int value[6];
+};
+
+int offset_register(int axis)
+{
+    return axis < 3 ? REGISTER_FOR_XA_OFFS_H + 2*axis : REGISTER_FOR_XG_OFFS_USRH + 2*(axis - 3);
+}
+
+template <class Bus>
+void read_offsets(Bus &bus, SensorOffsets *offsets)
+{
+    for (int axis = 0; axis < 6; axis++)
+        offsets->value[axis] = read_word_2c(bus, offset_register(axis));
+}
+
+template <class Bus>
+void write_offsets(Bus &bus, const SensorOffsets &offsets)
+{
+    for (int axis = 0; axis < 6; axis++)
+        write_word_2c(bus, offset_register(axis), offsets.value[axis]);
+}
+
+/* Mean of accel X, Y, Z and gyro X, Y, Z in raw register values */
+template <class Bus>
+void measure_mean(Bus &bus, int samples, double mean[6])
+{
+    for (int axis = 0; axis < 6; axis++)
+        mean[axis] = 0;
+    for (int i = 0; i < samples; i++)
+    {
+        mean[0] += read_word_2c(bus, REGISTER_FOR_ACCEL_XOUT_H);
+        mean[1] += read_word_2c(bus, REGISTER_FOR_ACCEL_YOUT_H);
+        mean[2] += read_word_2c(bus, REGISTER_FOR_ACCEL_ZOUT_H);
+        mean[3] += read_word_2c(bus, REGISTER_FOR_GYRO_XOUT_H);
+        mean[4] += read_word_2c(bus, REGISTER_FOR_GYRO_YOUT_H);
+        mean[5] += read_word_2c(bus, REGISTER_FOR_GYRO_ZOUT_H);
+    }
+    for (int axis = 0; axis < 6; axis++)
+        mean[axis] /= samples;
+}
+
+/* Error of each axis from lying flat and still, in raw register values */
+template <class Bus>
+void measure_error(Bus &bus, int samples, double error[6])
+{
+    measure_mean(bus, samples, error);
+    error[2] -= ACCEL_LSB_PER_G;
+}
+
+/* Programs the offset registers so that the sensor reads 0, 0, 1 g and no rotation.
+   Returns true when the remaining error is within the tolerances, which is given in residual */
+template <class Bus>
+bool calibrate_offsets(Bus &bus, SensorOffsets *offsets, double residual[6])
+{
+    double accel_step = ACCEL_LSB_PER_G / ACCEL_OFFSET_LSB_PER_G;
+    double gyro_step  = GYRO_LSB_PER_DEG_PER_SEC / GYRO_OFFSET_LSB_PER_DEG_PER_SEC;
+
+    read_offsets(bus, offsets);
+    for (int iteration = 0; iteration < OFFSET_CALIBRATION_ITERATIONS; iteration++)
+    {
+        measure_error(bus, OFFSET_CALIBRATION_SAMPLES, residual);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            // Bit 0 of the accel offsets is reserved and must keep its value
+            int reserved = offsets->value[axis] & 1;
+            int value = offsets->value[axis] - (int)lround(residual[axis] / accel_step);
+            offsets->value[axis] = (value & ~1) | reserved;
+            offsets->value[axis + 3] -= (int)lround(residual[axis + 3] / gyro_step);
+        }
+        write_offsets(bus, *offsets);
+    }
+    measure_error(bus, OFFSET_CALIBRATION_SAMPLES, residual);
+
+    for (int axis = 0; axis < 6; axis++)
+        if (fabs(residual[axis]) > (axis < 3 ? OFFSET_ACCEL_TOLERANCE : OFFSET_GYRO_TOLERANCE))
+            return false;
+    return true;
+}
+
+bool offsets_load(const char *path, const char *device, SensorOffsets *offsets)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+    char line[256];
+    char line_device[32];
+    int *v = offsets->value;
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file))
+        found = sscanf(line, "%31s %d %d %d %d %d %d", line_device, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 7 &&
+                strcmp(line_device, device) == 0;
+    fclose(file);
+    return found;
+}
+
+bool offsets_save(const char *path, const char *device, const SensorOffsets &offsets)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+    const int *v = offsets.value;
+    fprintf(file, "# device xa ya za xg yg zg\n");
+    fprintf(file, "%s %d %d %d %d %d %d\n", device, v[0], v[1], v[2], v[3], v[4], v[5]);
+    return fclose(file) == 0;
+}
+
+#endif
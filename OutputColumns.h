@@ -0,0 +1,331 @@
+/*
+ The columns of the demonstration program, and only the work they need.
+
+ The program can print, for roll and pitch each, the accelerometer-only angle, the
+ integrated gyro, a complementary filter and the fusion engine, and the temperature.
+ The columns to print are chosen at startup, and columns_update() skips every stage no
+ selected column depends on:
+
+   accel          the accelerometer angles (atan), also needed by the gyro and
+                  complementary columns and by engines with needs_accel_angles (the
+                  Kalman engine only for the samples it corrects with)
+   gyro           the integration of the gyro rates, with the integration in
+                  RateIntegration.h that is also used by the complementary filter
+   complementary  the complementary filter
+   fused          the fusion engine always runs, as the gyro and complementary columns
+                  use its angles; an engine with lazy_angles is only asked for them when
+                  they are printed or used
+   temp           the temperature, the caller skips reading TEMP_OUT without it
+
+ The checks are on a bit mask that only changes between samples, on a command of the control
+ socket, so the branches are predicted right and cost next to nothing compared to the stages
+ they skip.
+
+ The columns follow the angle convention of their engine (Engine::convention, see
+ FusionEngine.h). columns_update_both() runs two sets of columns, one per convention, on the
+ same sample, with the accelerometer angles of both computed together.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _OutputColumns_h
+#define _OutputColumns_h
+
+#include "FusionEngine.h"
+#include <stdio.h>
+#include <string.h>
+
+#define COLUMN_ACCEL                   0x01
+#define COLUMN_GYRO                    0x02
+#define COLUMN_COMPLEMENTARY           0x04
+#define COLUMN_FUSED                   0x08
+#define COLUMN_TEMP                    0x10
+#define COLUMN_ALL                     0x1F
+#define COLUMN_KINDS                   5
+#define COMPLEMENTARY_GYRO_WEIGHT      0.93
+#define COMPLEMENTARY_ACCEL_WEIGHT     0.07
+
+const char *column_names[COLUMN_KINDS] = { "accel", "gyro", "complementary", "fused", "temp" };
+
+struct OutputColumns {
+    int    selected;            /* COLUMN_ bits */
+    double roll;                /* Accelerometer only */
+    double roll_gyro;           /* Integrated gyro without any filter */
+    double roll_complementary;  /* Angle exposed to a complementary filter */
+    double roll_fused;          /* Angle exposed to the selected fusion engine (Kalman by default) */
+    double pitch;
+    double pitch_gyro;
+    double pitch_complementary;
+    double pitch_fused;
+
+    double          complementary_gyro;  /* Weights of the complementary filter */
+    double          complementary_accel;
+    RateIntegration integration;
+    RateHistory     roll_history;
+    RateHistory     pitch_history;
+    bool            restricted_flipped; /* The rate of the restricted axis is negated past ±90 degrees */
+};
+
+/* Parses a comma separated list of column names, returns 0 when a name is unknown */
+int columns_from_list(const char *list)
+{
+    char copy[128];
+    int selected = 0;
+    snprintf(copy, sizeof(copy), "%s", list);
+    for (char *name = strtok(copy, ","); name; name = strtok(NULL, ","))
+    {
+        int kind = 0;
+        while (kind < COLUMN_KINDS && strcmp(name, column_names[kind]) != 0)
+            kind++;
+        if (kind == COLUMN_KINDS)
+            return 0;
+        selected |= 1 << kind;
+    }
+    return selected;
+}
+
+/* Writes the selected columns as a comma separated list */
+void columns_to_list(int selected, char *list, size_t size)
+{
+    list[0] = 0;
+    for (int kind = 0; kind < COLUMN_KINDS; kind++)
+        if (selected & (1 << kind))
+            snprintf(list + strlen(list), size - strlen(list), "%s%s", list[0] ? "," : "", column_names[kind]);
+}
+
+/* Selects the columns and starts all of them at the same angles */
+void columns_start(OutputColumns *columns, int selected, double roll, double pitch)
+{
+    columns->selected            = selected;
+    columns->roll                = roll;
+    columns->roll_gyro           = roll;
+    columns->roll_complementary  = roll;
+    columns->roll_fused          = roll;
+    columns->pitch               = pitch;
+    columns->pitch_gyro          = pitch;
+    columns->pitch_complementary = pitch;
+    columns->pitch_fused         = pitch;
+    columns->complementary_gyro  = COMPLEMENTARY_GYRO_WEIGHT;
+    columns->complementary_accel = COMPLEMENTARY_ACCEL_WEIGHT;
+    columns->integration         = INTEGRATE_EULER;
+    columns->restricted_flipped  = false;
+    rate_history_reset(&columns->roll_history);
+    rate_history_reset(&columns->pitch_history);
+}
+
+/* Sets the gyro weight of the complementary filter, the accelerometer gets the rest */
+void columns_set_complementary(OutputColumns *columns, double gyro_weight)
+{
+    columns->complementary_gyro  = gyro_weight;
+    columns->complementary_accel = 1 - gyro_weight;
+}
+
+/* Whether the engine uses the accelerometer angles of the next sample */
+template <class Engine>
+bool engine_needs_accel_angles(Engine &)
+{
+    return Engine::needs_accel_angles;
+}
+
+template <AngleConvention convention>
+bool engine_needs_accel_angles(KalmanEngineIn<convention> &engine)
+{
+    return engine.correctsNext();
+}
+
+/* Whether the selected stages or the engine use the accelerometer angles of the next sample */
+template <class Engine>
+bool columns_need_accel_angles(const OutputColumns &c, Engine &engine)
+{
+    return (c.selected & (COLUMN_ACCEL | COLUMN_GYRO | COLUMN_COMPLEMENTARY)) || engine_needs_accel_angles(engine);
+}
+
+/* One sample through the selected stages, with the accelerometer angles of the sample already
+   calculated in the convention of the engine when columns_need_accel_angles() */
+template <class Engine>
+void columns_update_with_angles(OutputColumns *columns, Engine &engine, const ImuSample &sample,
+                                double roll_rate, double pitch_rate, double dt, bool output)
+{
+    OutputColumns &c = *columns;
+    bool integrate   = (c.selected & (COLUMN_GYRO | COLUMN_COMPLEMENTARY)) != 0;
+
+    if (columns_need_accel_angles(c, engine))
+    {
+        c.roll  = sample.roll;
+        c.pitch = sample.pitch;
+
+        if (Engine::convention == PITCH_RESTRICTED)
+        {
+            /* Let pitch have -90 and 90 degrees to be the continuous (and roll ±180) */
+            if ( !(abs(c.roll)<= 90 || abs(c.roll_fused)<= 90) )
+            {
+                c.roll_complementary = c.roll;
+                c.roll_gyro          = c.roll;
+            }
+        }
+        else
+        {
+            /* Let roll have -90 and 90 degrees to be the continuous (and pitch ±180) */
+            if ( !(abs(c.pitch)<= 90 || abs(c.pitch_fused)<= 90) )
+            {
+                c.pitch_complementary = c.pitch;
+                c.pitch_gyro          = c.pitch;
+            }
+        }
+    }
+
+    engine.update(sample, dt);
+    if (integrate || !Engine::lazy_angles || (output && (c.selected & COLUMN_FUSED)))
+        engine.getAngles(&c.roll_fused, &c.pitch_fused);
+    if (!integrate)
+        return;
+
+    /* The previous rates are kept in the convention of the current one */
+    bool flipped;
+    if (Engine::convention == PITCH_RESTRICTED)
+    {
+        pitch_rate = max_90_deg_correction(pitch_rate, c.roll_fused);
+        flipped    = abs(c.roll_fused) > 90;
+        if (flipped != c.restricted_flipped)
+            rate_history_negate(&c.pitch_history);
+    }
+    else
+    {
+        roll_rate = max_90_deg_correction(roll_rate, c.pitch_fused);
+        flipped   = abs(c.pitch_fused) > 90;
+        if (flipped != c.restricted_flipped)
+            rate_history_negate(&c.roll_history);
+    }
+    c.restricted_flipped = flipped;
+    double roll_increment  = integrate_rate(&c.roll_history, c.integration, roll_rate, dt);
+    double pitch_increment = integrate_rate(&c.pitch_history, c.integration, pitch_rate, dt);
+
+    /* Calculate gyro angles without any filter */
+    if (c.selected & COLUMN_GYRO)
+    {
+        c.roll_gyro  += roll_increment;
+        c.pitch_gyro += pitch_increment;
+        c.roll_gyro   = max_drift_correction(c.roll_gyro, c.roll_fused);
+        c.pitch_gyro  = max_drift_correction(c.pitch_gyro, c.pitch_fused);
+    }
+
+    /* Calculate the angle using a Complimentary filter */
+    if (c.selected & COLUMN_COMPLEMENTARY)
+    {
+        c.roll_complementary  = c.complementary_gyro * (c.roll_complementary + roll_increment) + c.complementary_accel * c.roll;
+        c.pitch_complementary = c.complementary_gyro * (c.pitch_complementary + pitch_increment) + c.complementary_accel * c.pitch;
+    }
+}
+
+/* One sample through the selected stages. The sample has the rates for the engine, the gyro
+   and complementary columns get roll_rate and pitch_rate with the startup offsets removed.
+   output tells whether the sample is printed */
+template <class Engine>
+void columns_update(OutputColumns *columns, Engine &engine, ImuSample sample,
+                    double roll_rate, double pitch_rate, double dt, bool output)
+{
+    if (columns_need_accel_angles(*columns, engine))
+        accel_angles(Engine::convention, sample.accX, sample.accY, sample.accZ, &sample.roll, &sample.pitch);
+    columns_update_with_angles(columns, engine, sample, roll_rate, pitch_rate, dt, output);
+}
+
+/* The same sample through two sets of columns, each with its own convention and engine, with
+   the accelerometer angles of both conventions calculated together. The second engine may
+   be a view of the first (see ConventionView in FusionEngine.h), so the first is updated first */
+template <class Engine, class SecondEngine>
+void columns_update_both(OutputColumns *columns, Engine &engine, OutputColumns *second, SecondEngine &second_engine,
+                         ImuSample sample, double roll_rate, double pitch_rate, double dt, bool output)
+{
+    ImuSample second_sample = sample;
+    if (columns_need_accel_angles(*columns, engine) || columns_need_accel_angles(*second, second_engine))
+    {
+        double roll[ANGLE_CONVENTION_COUNT];
+        double pitch[ANGLE_CONVENTION_COUNT];
+        accel_angles_both(sample.accX, sample.accY, sample.accZ, roll, pitch);
+        sample.roll         = roll[Engine::convention];
+        sample.pitch        = pitch[Engine::convention];
+        second_sample.roll  = roll[SecondEngine::convention];
+        second_sample.pitch = pitch[SecondEngine::convention];
+    }
+    columns_update_with_angles(columns, engine, sample, roll_rate, pitch_rate, dt, output);
+    columns_update_with_angles(second, second_engine, second_sample, roll_rate, pitch_rate, dt, output);
+}
+
+/* Changes the selected columns between two samples. The gyro and complementary columns that
+   were not computed start again from the angles of the engine */
+template <class Engine>
+void columns_select(OutputColumns *columns, Engine &engine, int selected)
+{
+    int integrated = COLUMN_GYRO | COLUMN_COMPLEMENTARY;
+    int started    = selected & ~columns->selected;
+    if (started & integrated)
+        engine.getAngles(&columns->roll_fused, &columns->pitch_fused);
+    if (started & COLUMN_GYRO)
+    {
+        columns->roll_gyro  = columns->roll_fused;
+        columns->pitch_gyro = columns->pitch_fused;
+    }
+    if (started & COLUMN_COMPLEMENTARY)
+    {
+        columns->roll_complementary  = columns->roll_fused;
+        columns->pitch_complementary = columns->pitch_fused;
+    }
+    if ((started & integrated) && !(columns->selected & integrated))
+    {
+        rate_history_reset(&columns->roll_history);
+        rate_history_reset(&columns->pitch_history);
+    }
+    columns->selected = selected;
+}
+
+/* Prints the labels of the selected columns, roll first and then pitch, with the names of the axes */
+void columns_print_labels(FILE *file, const OutputColumns &c, const char *axes[2], const char *engine)
+{
+    for (int axis = 0; axis < 2; axis++)
+    {
+        if (c.selected & COLUMN_ACCEL)         fprintf(file, "%s \t ", axes[axis]);
+        if (c.selected & COLUMN_GYRO)          fprintf(file, "%s_gyro \t ", axes[axis]);
+        if (c.selected & COLUMN_COMPLEMENTARY) fprintf(file, "%s_complementary \t ", axes[axis]);
+        if (c.selected & COLUMN_FUSED)         fprintf(file, "%s_%s \t ", axes[axis], engine);
+        fprintf(file, "\t \t ");
+    }
+}
+
+/* Prints the values of the selected columns in the layout of columns_print_labels() */
+void columns_print_values(FILE *file, const OutputColumns &c)
+{
+    double values[2][4] = { { c.roll, c.roll_gyro, c.roll_complementary, c.roll_fused },
+                            { c.pitch, c.pitch_gyro, c.pitch_complementary, c.pitch_fused } };
+    const char *separators[4] = { "\t\t", "\t\t\t", "\t\t", "\t" };
+
+    for (int axis = 0; axis < 2; axis++)
+    {
+        for (int kind = 0; kind < 4; kind++)
+            if (c.selected & (1 << kind))
+            {
+                fprintf(file, "%.1f", values[axis][kind]); fprintf(file, "%s", separators[kind]);
+            }
+        fprintf(file, "\t\t");
+    }
+}
+
+/* Prints a line of values: the columns, those of the other convention when second is set,
+   and the temperature when it is selected */
+void columns_print_line(FILE *file, const OutputColumns &c, const OutputColumns *second, double temp_degrees_c)
+{
+    columns_print_values(file, c);
+    if (second)
+        columns_print_values(file, *second);
+    if (c.selected & COLUMN_TEMP)
+    {
+        fprintf(file, "%.1f", temp_degrees_c); fprintf(file, "\t");
+    }
+    fprintf(file, "\r\n");
+}
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ History of the time per sample of the stages of the loop, to catch slowdowns before they
+ reach a device.
+
+ The stages are the CPU work of one sample of the demonstration program, timed on its own
+ code:
+
+   i2c_read       sensor_read() of SensorRead.h with the temperature, on the simulated bus
+                  of SensorBus.h, with the simulated sensor (the time on the bus itself is
+                  set by its clock and is not counted)
+   angle_math     the accelerometer angles
+   get_angle      the Kalman engine on both axes
+   output_format  columns_print_line() of OutputColumns.h with all columns, into a buffer
+
+ The history is a JSON array with one record per commit:
+
+   [
+   {"commit": "d3017b3", "time": 1760659200, "compiler": "12.2.0", "stages_ns": {"i2c_read": 1.5, ...}},
+   ...
+   ]
+
+ written with one record per line, which is also how it is read back, so it must not be
+ reformatted. A comparison takes the latest record against a baseline (by default the
+ record before it) and flags every stage that got slower by more than its budget: a
+ percentage of the baseline, plus PERF_BUDGET_SLACK_NS for the timing noise of stages of
+ a few ns.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _PerfHistory_h
+#define _PerfHistory_h
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define PERF_STAGE_COUNT               4
+#define PERF_TEXT_LENGTH               64
+#define PERF_BUDGET_PERCENT            20.0  /* Default budget of every stage, above the run to run noise of a desktop */
+#define PERF_BUDGET_SLACK_NS           1.0
+
+enum PerfStage {
+    STAGE_I2C_READ,
+    STAGE_ANGLE_MATH,
+    STAGE_GET_ANGLE,
+    STAGE_OUTPUT_FORMAT
+};
+
+const char *perf_stage_names[PERF_STAGE_COUNT] = { "i2c_read", "angle_math", "get_angle", "output_format" };
+
+struct PerfRecord {
+    char   commit[PERF_TEXT_LENGTH];
+    long   time;
+    char   compiler[PERF_TEXT_LENGTH];
+    double stage_ns[PERF_STAGE_COUNT];
+};
+
+/* Returns the stage with the given name, or -1 if there is none */
+int perf_stage_from_name(const char *name)
+{
+    for (int stage = 0; stage < PERF_STAGE_COUNT; stage++)
+        if (strcmp(name, perf_stage_names[stage]) == 0)
+            return stage;
+    return -1;
+}
+
+void perf_write_record(FILE *file, const PerfRecord &record)
+{
+    fprintf(file, "{\"commit\": \"%s\", \"time\": %ld, \"compiler\": \"%s\", \"stages_ns\": {",
+            record.commit, record.time, record.compiler);
+    for (int stage = 0; stage < PERF_STAGE_COUNT; stage++)
+        fprintf(file, "%s\"%s\": %.1f", stage ? ", " : "", perf_stage_names[stage], record.stage_ns[stage]);
+    fprintf(file, "}}");
+}
+
+/* Parses a line written by perf_write_record(), with or without the trailing comma */
+bool perf_read_record(const char *line, PerfRecord *record)
+{
+    int length = 0;
+    if (sscanf(line, "{\"commit\": \"%63[^\"]\", \"time\": %ld, \"compiler\": \"%63[^\"]\", \"stages_ns\": {%n",
+               record->commit, &record->time, record->compiler, &length) != 3 || length == 0)
+        return false;
+    const char *stages = line + length;
+    for (int stage = 0; stage < PERF_STAGE_COUNT; stage++)
+    {
+        const char *value = strstr(stages, perf_stage_names[stage]);
+        if (!value || sscanf(value + strlen(perf_stage_names[stage]), "\": %lf", &record->stage_ns[stage]) != 1)
+            return false;
+    }
+    return true;
+}
+
+/* Reads the history, which is empty when the file does not exist yet. Returns false if a record is broken */
+bool perf_history_load(const char *path, std::vector<PerfRecord> *records)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return true;
+    char line[512];
+    bool valid = true;
+    while (fgets(line, sizeof(line), file))
+    {
+        PerfRecord record;
+        if (line[0] != '{')
+            continue;
+        if (perf_read_record(line, &record))
+            records->push_back(record);
+        else
+            valid = false;
+    }
+    fclose(file);
+    return valid;
+}
+
+/* Writes the history to a temporary file first and then renames it, as FilterState.h does */
+bool perf_history_save(const char *path, const std::vector<PerfRecord> &records)
+{
+    char temp_path[512];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "w");
+    if (!file)
+        return false;
+    fprintf(file, "[\n");
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        perf_write_record(file, records[i]);
+        fprintf(file, "%s\n", i + 1 < records.size() ? "," : "");
+    }
+    fprintf(file, "]\n");
+    if (fclose(file) != 0)
+        return false;
+    return rename(temp_path, path) == 0;
+}
+
+/* Whether the stage got slower than its budget in percent allows */
+bool perf_over_budget(double baseline_ns, double latest_ns, double budget_percent)
+{
+    return latest_ns > baseline_ns * (1 + budget_percent / 100) + PERF_BUDGET_SLACK_NS;
+}
+
+#endif
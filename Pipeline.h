@@ -0,0 +1,236 @@
+/*
+ The acquire, fuse and emit loop of the demonstration program as a template over its three
+ parts, for deployments that know their configuration when they are compiled.
+
+   Pipeline<Source, Engine, Sink>
+
+ Source is where the samples come from: BusSource<Bus> reads the sensor through a bus of
+ WiringPiBus.h, SimulatedMpu6050.h or SensorBus.h with sensor_read() of SensorRead.h, the
+ read of the program, with its full-scale ranges, the wait for the data ready flag at a
+ configured rate and TEMP_OUT only for a sink that needs it. ReplaySource walks a capture.
+ Engine is any fusion engine of FusionEngine.h. Sink is what is done with each sample:
+ PrintSink prints the line of the program with only the fused columns (-c fused),
+ CaptureSink records the raw sample (see Capture.h) and NullSink drops it. Each part is a
+ plain class whose choices are static constants, so step() is compiled into one loop for
+ the configuration, with the engine and the sink inlined and the checks for what the
+ configuration does not need folded away: the accelerometer angles are only calculated
+ for engines that use them, and the angles of an engine with lazy_angles only for a sink
+ that uses them.
+
+ The demonstration program is the build that is configured at runtime. Its pipeline
+ benchmark (-P) runs this loop for each engine and sink next to its own, on the same bus.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _Pipeline_h
+#define _Pipeline_h
+
+#include "FusionEngine.h"
+#include "Capture.h"
+#include "OutputColumns.h"
+#include "SampleRate.h"
+#include "SensorRead.h"
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+enum OutputSink {
+    SINK_PRINT,
+    SINK_CAPTURE,
+    SINK_NONE,
+    OUTPUT_SINK_COUNT
+};
+
+const char *output_sink_names[OUTPUT_SINK_COUNT] = { "print", "capture", "none" };
+
+/* Reads the sensor on the bus as the program does, timed with CLOCK_MONOTONIC. At a rate the
+   time steps are whole sample periods, as sample_rate_dt() gives the program */
+template <class Bus>
+class BusSource {
+public:
+    BusSource() {
+        bus = NULL;
+        range = NULL;
+        paced = false;
+        t_us = -1;
+    };
+
+    /* Reads from the bus, with the full-scale ranges of range_configure() and the rate of
+       sample_rate_configure() the sensor was set to, NULL without a rate */
+    void attach(Bus *source_bus, FullScaleRange *source_range, const SampleRateConfig *config) {
+        bus   = source_bus;
+        range = source_range;
+        paced = config != NULL;
+        if (paced)
+            rate = *config;
+        t_us  = -1;
+        reading.temp_raw = 0;
+    };
+
+    bool read(CaptureRecord *record, bool read_temperature) {
+        struct timespec now;
+        sensor_read(*bus, range, paced ? rate.dt : 0, read_temperature, &reading);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double now_us = now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+        if (paced && t_us >= 0)
+            t_us += sample_rate_dt(rate, (now_us - read_us) / 1000000) * 1000000;
+        else
+            t_us = now_us;
+        read_us = now_us;
+
+        /* The factors are powers of two, the values stay whole LSB */
+        record->t_us      = t_us;
+        record->accX      = (int)reading.accX;
+        record->accY      = (int)reading.accY;
+        record->accZ      = (int)reading.accZ;
+        record->gyroX     = (int)reading.gyroX;
+        record->gyroY     = (int)reading.gyroY;
+        record->gyroZ     = (int)reading.gyroZ;
+        record->temp_raw  = (int)reading.temp_raw;
+        record->has_truth = false;
+        return true;
+    };
+
+private:
+    Bus              *bus;
+    FullScaleRange   *range;
+    SampleRateConfig rate;
+    bool             paced;
+    SensorReading    reading;
+    double           t_us;     /* Of the last sample */
+    double           read_us;  /* When the last sample was read */
+};
+
+/* The records of a capture, once */
+class ReplaySource {
+public:
+    ReplaySource() {
+        records = NULL;
+        next = 0;
+    };
+
+    void replay(const std::vector<CaptureRecord> *replayed) {
+        records = replayed;
+        next = 0;
+    };
+    bool read(CaptureRecord *record, bool) {
+        if (next >= records->size())
+            return false;
+        *record = (*records)[next++];
+        return true;
+    };
+
+private:
+    const std::vector<CaptureRecord> *records;
+    size_t next;
+};
+
+/* Prints the line of the program with only the fused columns, without the labels */
+class PrintSink {
+public:
+    static const OutputSink id = SINK_PRINT;
+    static const bool needs_angles = true;
+    static const bool needs_temperature = false;
+
+    PrintSink() {
+        file = stdout;
+        columns.selected = COLUMN_FUSED;
+    };
+    void emit(const CaptureRecord &, double roll, double pitch) {
+        columns.roll_fused  = roll;
+        columns.pitch_fused = pitch;
+        columns_print_line(file, columns, NULL, 0);
+    };
+
+    FILE *file;
+
+private:
+    OutputColumns columns;
+};
+
+/* Records the raw samples for replay by the tools */
+class CaptureSink {
+public:
+    static const OutputSink id = SINK_CAPTURE;
+    static const bool needs_angles = false;
+    static const bool needs_temperature = true;
+
+    CaptureSink() { file = NULL; };
+    void emit(const CaptureRecord &record, double, double) { capture_write(file, record); };
+
+    FILE *file;
+};
+
+/* Drops the samples, the angles stay in the engine */
+class NullSink {
+public:
+    static const OutputSink id = SINK_NONE;
+    static const bool needs_angles = false;
+    static const bool needs_temperature = false;
+
+    void emit(const CaptureRecord &, double, double) {};
+};
+
+/* The sample of a record as the engines see it, without the accelerometer angles */
+ImuSample pipeline_sample(const CaptureRecord &record)
+{
+    ImuSample sample;
+    sample.accX       = record.accX;
+    sample.accY       = record.accY;
+    sample.accZ       = record.accZ;
+    sample.roll_rate  = convert_to_deg_per_sec(record.gyroX);
+    sample.pitch_rate = convert_to_deg_per_sec(record.gyroY);
+    sample.yaw_rate   = convert_to_deg_per_sec(record.gyroZ);
+    return sample;
+}
+
+template <class Source, class Engine, class Sink>
+class Pipeline {
+public:
+    /* Reads the first sample and starts the engine at its accelerometer angles, false when there is none */
+    bool start() {
+        CaptureRecord record;
+        if (!source.read(&record, Sink::needs_temperature))
+            return false;
+        ImuSample sample = pipeline_sample(record);
+        accel_angles(Engine::convention, sample.accX, sample.accY, sample.accZ, &sample.roll, &sample.pitch);
+        engine.setAngle(sample.roll, sample.pitch);
+        last_t_us = record.t_us;
+        return true;
+    };
+
+    /* Reads, fuses and emits one sample, false when the source has no more */
+    bool step() {
+        CaptureRecord record;
+        double roll  = 0;
+        double pitch = 0;
+        if (!source.read(&record, Sink::needs_temperature))
+            return false;
+        ImuSample sample = pipeline_sample(record);
+        if (engine_needs_accel_angles(engine))
+            accel_angles(Engine::convention, sample.accX, sample.accY, sample.accZ, &sample.roll, &sample.pitch);
+        engine.update(sample, (record.t_us - last_t_us) / 1000000);
+        last_t_us = record.t_us;
+        if (Sink::needs_angles)
+            engine.getAngles(&roll, &pitch);
+        sink.emit(record, roll, pitch);
+        return true;
+    };
+
+    void getAngles(double *roll, double *pitch) { engine.getAngles(roll, pitch); };
+
+    Source source;
+    Engine engine;
+    Sink   sink;
+
+private:
+    double last_t_us;
+};
+
+#endif
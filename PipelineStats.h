@@ -0,0 +1,112 @@
+/*
+ Throughput and latency of the acquire, fuse and output loop, for the pipeline benchmark.
+
+ Each sample is timed from the start of its read to the end of its output. Over a run of
+ a fixed duration this gives, per engine, sink and build (the loop of the program, or the
+ one of Pipeline.h compiled for the engine and the sink):
+
+   hz           samples per second of wall time, the highest rate the loop can sustain
+   cpu_us       CPU time per sample, without the CPU time spent waiting on the simulated bus
+   p50_us ...   percentiles of the time per sample, the tail is what decides whether the
+                loop keeps up with the sensor at a given rate
+   max_us       the slowest sample
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _PipelineStats_h
+#define _PipelineStats_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+struct PipelineStats {
+    std::vector<double> sample_us;
+    double duration_seconds;
+    double start_seconds;
+    double start_cpu_seconds;
+    double start_waited_seconds;
+    double end_seconds;
+    double end_cpu_seconds;
+};
+
+double pipeline_clock(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Wall time in seconds, to pass to pipeline_stats_add() at the start of a sample */
+double pipeline_now()
+{
+    return pipeline_clock(CLOCK_MONOTONIC);
+}
+
+/* Starts a run of the duration, waited_seconds is the CPU time of the bus so far */
+void pipeline_stats_start(PipelineStats *stats, double duration_seconds, double waited_seconds)
+{
+    stats->sample_us.clear();
+    stats->duration_seconds     = duration_seconds;
+    stats->start_waited_seconds = waited_seconds;
+    stats->start_cpu_seconds    = pipeline_clock(CLOCK_PROCESS_CPUTIME_ID);
+    stats->start_seconds        = pipeline_now();
+    stats->end_seconds          = stats->start_seconds;
+    stats->end_cpu_seconds      = stats->start_cpu_seconds;
+}
+
+/* Adds a sample that started at sample_start, returns false when the run is over */
+bool pipeline_stats_add(PipelineStats *stats, double sample_start)
+{
+    double now = pipeline_now();
+    stats->sample_us.push_back((now - sample_start) * 1000000);
+    stats->end_seconds = now;
+    if (now - stats->start_seconds < stats->duration_seconds)
+        return true;
+    stats->end_cpu_seconds = pipeline_clock(CLOCK_PROCESS_CPUTIME_ID);
+    return false;
+}
+
+/* Whether the run lasted its duration, and was not stopped */
+bool pipeline_stats_complete(const PipelineStats &stats)
+{
+    return stats.end_seconds - stats.start_seconds >= stats.duration_seconds;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double difference = *(const double *)a - *(const double *)b;
+    return (difference > 0) - (difference < 0);
+}
+
+void pipeline_stats_header(FILE *file)
+{
+    fprintf(file, "%-14s %-8s %-9s %10s %10s %10s %10s %10s %10s\n",
+            "engine", "sink", "build", "hz", "cpu_us", "p50_us", "p99_us", "p99.9_us", "max_us");
+}
+
+/* One line for the run, waited_seconds is the CPU time of the bus at its end */
+void pipeline_stats_report(FILE *file, PipelineStats *stats, const char *engine, const char *sink, const char *build,
+                           double waited_seconds)
+{
+    size_t count = stats->sample_us.size();
+    if (count == 0)
+        return;
+    double *sample_us = &stats->sample_us[0];
+    qsort(sample_us, count, sizeof(double), compare_doubles);
+
+    double seconds     = stats->end_seconds - stats->start_seconds;
+    double cpu_seconds = stats->end_cpu_seconds - stats->start_cpu_seconds - (waited_seconds - stats->start_waited_seconds);
+    fprintf(file, "%-14s %-8s %-9s %10.0f %10.2f %10.1f %10.1f %10.1f %10.1f\n", engine, sink, build, count / seconds,
+            cpu_seconds * 1000000 / count, sample_us[count / 2], sample_us[count * 99 / 100],
+            sample_us[count * 999 / 1000], sample_us[count - 1]);
+}
+
+#endif
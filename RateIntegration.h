@@ -0,0 +1,84 @@
+/*
+ Integration of the gyro rates into angles, of first to third order.
+
+ The gyro and complementary columns have always added rate * dt per sample (Euler), which
+ is only exact while the rate is constant, so the error grows with the square of the time
+ between samples for any smooth motion. The higher orders use the rates of the previous
+ samples as well:
+
+   euler        dt * r(n)                                      first order
+   trapezoidal  dt * (r(n) + r(n-1)) / 2                       second order (Heun, RK2)
+   quadratic    dt * (5 r(n) + 8 r(n-1) - r(n-2)) / 12         third order (Adams-Moulton)
+
+ The quadratic rule takes the samples as equally spaced, which they are when the loop runs
+ at the pace of the sensor (see SampleRate.h). Until enough rates have been seen the
+ lower orders are used.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _RateIntegration_h
+#define _RateIntegration_h
+
+#include <string.h>
+
+enum RateIntegration {
+    INTEGRATE_EULER,
+    INTEGRATE_TRAPEZOIDAL,
+    INTEGRATE_QUADRATIC,
+    RATE_INTEGRATION_COUNT
+};
+
+const char *rate_integration_names[RATE_INTEGRATION_COUNT] = { "euler", "trapezoidal", "quadratic" };
+
+/* Returns the integration with the given name, or RATE_INTEGRATION_COUNT if there is none */
+RateIntegration rate_integration_from_name(const char *name)
+{
+    for (int i = 0; i < RATE_INTEGRATION_COUNT; i++)
+        if (strcmp(name, rate_integration_names[i]) == 0)
+            return (RateIntegration)i;
+    return RATE_INTEGRATION_COUNT;
+}
+
+/* The previous rates of one axis, newest first */
+struct RateHistory {
+    double rate[2];
+    int    count;
+};
+
+void rate_history_reset(RateHistory *history)
+{
+    history->count = 0;
+}
+
+/* For an axis whose rate changes sign by convention, such as the restricted axis past ±90 degrees */
+void rate_history_negate(RateHistory *history)
+{
+    history->rate[0] = -history->rate[0];
+    history->rate[1] = -history->rate[1];
+}
+
+/* The angle the axis turned over the last dt seconds, ending with the rate */
+double integrate_rate(RateHistory *history, RateIntegration method, double rate, double dt)
+{
+    double increment;
+    if (method == INTEGRATE_QUADRATIC && history->count >= 2)
+        increment = dt * (5 * rate + 8 * history->rate[0] - history->rate[1]) * (1.0 / 12);
+    else if (method != INTEGRATE_EULER && history->count >= 1)
+        increment = dt * (rate + history->rate[0]) * 0.5;
+    else
+        increment = dt * rate;
+
+    history->rate[1] = history->rate[0];
+    history->rate[0] = rate;
+    if (history->count < 2)
+        history->count++;
+    return increment;
+}
+
+#endif
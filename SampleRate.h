@@ -0,0 +1,88 @@
+/*
+ Sample rate (SMPLRT_DIV) and digital low-pass filter (DLPF_CFG) of the MPU6050.
+
+ After power on the sensor samples at 8 kHz without a low-pass filter, unrelated to how
+ often the loop reads it, so the loop reads whatever sample happens to be latest and
+ everything above half the loop rate aliases into the angles. Given the rate the fusion
+ runs at, the configuration here selects:
+
+   DLPF_CFG    the largest bandwidth below half the rate, so the sensor removes what
+               the loop cannot follow before it is sampled
+   SMPLRT_DIV  the divider of the 1 kHz gyro output rate that is closest to the rate
+
+ The resulting output data rate gives the nominal time step of the filters, and the
+ bandwidth of the accelerometer sets how noisy its angles are.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _SampleRate_h
+#define _SampleRate_h
+
+#include "Mpu6050.h"
+#include <math.h>
+
+#define DLPF_STEPS                     7
+#define DLPF_GYRO_OUTPUT_RATE_HZ       1000.0 /* With the low-pass filter on, DLPF_CFG 1 to 6 */
+#define DLPF_DEFAULT_ACCEL_BANDWIDTH   260.0  /* DLPF_CFG 0, the power on default */
+
+/* Bandwidth and delay for each DLPF_CFG, from the register map */
+const double dlpf_accel_bandwidth_hz[DLPF_STEPS] = { 260, 184, 94, 44, 21, 10, 5 };
+const double dlpf_gyro_bandwidth_hz[DLPF_STEPS]  = { 256, 188, 98, 42, 20, 10, 5 };
+const double dlpf_gyro_delay_ms[DLPF_STEPS]      = { 0.98, 1.9, 2.8, 4.8, 8.3, 13.4, 18.6 };
+
+struct SampleRateConfig {
+    int    dlpf_cfg;
+    int    smplrt_div;
+    double output_rate_hz;
+    double dt;           /* Seconds between two samples */
+};
+
+/* Chooses the low-pass filter and divider for the rate in Hz the fusion runs at */
+void sample_rate_choose(double rate_hz, SampleRateConfig *config)
+{
+    int divider = (int)lround(DLPF_GYRO_OUTPUT_RATE_HZ / rate_hz) - 1;
+    if (divider < 0)
+        divider = 0;
+    if (divider > 255)
+        divider = 255;
+    config->smplrt_div     = divider;
+    config->output_rate_hz = DLPF_GYRO_OUTPUT_RATE_HZ / (1 + divider);
+    config->dt             = 1 / config->output_rate_hz;
+
+    config->dlpf_cfg = DLPF_STEPS - 1;
+    for (int cfg = 1; cfg < DLPF_STEPS; cfg++)
+        if (dlpf_gyro_bandwidth_hz[cfg] < config->output_rate_hz / 2)
+        {
+            config->dlpf_cfg = cfg;
+            break;
+        }
+}
+
+template <class Bus>
+void sample_rate_configure(Bus &bus, const SampleRateConfig &config)
+{
+    bus.writeReg8(REGISTER_FOR_CONFIG, config.dlpf_cfg);
+    bus.writeReg8(REGISTER_FOR_SAMPLE_RATE, config.smplrt_div);
+}
+
+/* The time step for a measured time between two reads: a whole number of sample periods,
+   at least one, so that the jitter of the loop timing does not reach the filters */
+double sample_rate_dt(const SampleRateConfig &config, double seconds_passed)
+{
+    long periods = lround(seconds_passed / config.dt);
+    return (periods < 1 ? 1 : periods) * config.dt;
+}
+
+/* Factor for a measurement noise variance tuned at the power on bandwidth */
+double sample_rate_noise_scale(const SampleRateConfig &config)
+{
+    return dlpf_accel_bandwidth_hz[config.dlpf_cfg] / DLPF_DEFAULT_ACCEL_BANDWIDTH;
+}
+
+#endif
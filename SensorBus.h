@@ -0,0 +1,94 @@
+/*
+ The bus of the demonstration program: the sensor on I2C, or the simulated sensor.
+
+ The program talks to one global bus that is not a template parameter, so this class
+ chooses between the two at startup. It is a template over the bus of the real sensor,
+ SensorBusOn<WiringPiBus> in the program, so that the benchmark can run the simulated
+ side without wiringPi. With simulate() the registers are those of
+ SimulatedMpu6050.h, and every register transaction busy-waits for a fixed time, as the
+ I2C bus would take: one readReg8() at 100 kHz is about 400 us, at 400 kHz about 100 us.
+ The simulated sensor lies flat and still, with the noise of a real one.
+ The CPU time the waits take is summed, so that a benchmark can tell the CPU time of the
+ program apart from the simulated bus, which would leave the CPU free (the I2C driver
+ sleeps until the transfer is done). The choice costs one predicted branch
+ per register, next to nothing compared to an I2C transaction.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _SensorBus_h
+#define _SensorBus_h
+
+#include "SimulatedMpu6050.h"
+#include <time.h>
+
+template <class DeviceBus>
+class SensorBusOn {
+public:
+    SensorBusOn() {
+        simulated = false;
+        transaction_seconds = 0;
+        waited_seconds = 0;
+    };
+
+    /* Use the simulated sensor from now on, with this time per register transaction */
+    void simulate(double transaction_us) {
+        simulated = true;
+        transaction_seconds = transaction_us / 1000000;
+        sensor.accel_noise_g = 0.006;          // The noise densities of the datasheet at the full bandwidth
+        sensor.gyro_noise_deg_per_sec = 0.08;
+    };
+    bool isSimulated() { return simulated; };
+
+    void setup(int device_address) {
+        if (!simulated)
+            device.setup(device_address);
+    };
+    int readReg8(int register_address) {
+        if (!simulated)
+            return device.readReg8(register_address);
+        transaction();
+        return sensor.readReg8(register_address);
+    };
+    void writeReg8(int register_address, int value) {
+        if (!simulated) {
+            device.writeReg8(register_address, value);
+            return;
+        }
+        transaction();
+        sensor.writeReg8(register_address, value);
+    };
+
+    /* Total CPU time the simulated transactions have waited, in seconds */
+    double getWaitedSeconds() { return waited_seconds; };
+
+    SimulatedMpu6050 sensor;
+
+private:
+    static double now(clockid_t clock) {
+        struct timespec now;
+        clock_gettime(clock, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+    };
+    void transaction() {
+        if (transaction_seconds <= 0)
+            return;
+        double start_cpu = now(CLOCK_THREAD_CPUTIME_ID);
+        double start = now(CLOCK_MONOTONIC);
+        while (now(CLOCK_MONOTONIC) - start < transaction_seconds)
+            ;
+        waited_seconds += now(CLOCK_THREAD_CPUTIME_ID) - start_cpu;
+    };
+
+    DeviceBus device;
+    bool simulated;
+    double transaction_seconds;
+    double waited_seconds;
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ Reading one sample of the sensor, as the demonstration program does it on any bus.
+
+ A read takes the accel and gyro registers, and TEMP_OUT only when the caller needs the
+ temperature, and scales them with the factors of FullScaleRange.h into LSB of the default
+ ranges. At a configured rate (see SampleRate.h) it first waits for the data ready flag of
+ the next sample, which also tells that a pending full-scale range has reached the
+ samples. Without the flag the registers may still hold a sample of the old range, and
+ range_before_read() checks the flag itself.
+
+ The program, the stage benchmark and the compiled pipeline all read through sensor_read(),
+ so that they take the same registers and do the same work per sample.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _SensorRead_h
+#define _SensorRead_h
+
+#include "Mpu6050.h"
+#include "FullScaleRange.h"
+#include <time.h>
+#include <unistd.h>
+
+#define SAMPLE_POLL_US                 100   /* Between two reads of the data ready flag */
+
+/* One sample in LSB of the default full-scale ranges */
+struct SensorReading {
+    double accX;
+    double accY;
+    double accZ;
+    double gyroX;
+    double gyroY;
+    double gyroZ;
+    double temp_raw;  /* Left as it was when the temperature is not read */
+};
+
+/* Waits for the next sample of the sensor, at most timeout_seconds. Returns whether the data ready flag was seen */
+template <class Bus>
+bool sensor_wait_for_sample(Bus &bus, double timeout_seconds)
+{
+    struct timespec start;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do
+    {
+        if (bus.readReg8(REGISTER_FOR_INT_STATUS) & DATA_READY)
+            return true;
+        usleep(SAMPLE_POLL_US);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9 < timeout_seconds);
+    return false;
+}
+
+/* Reads a sample. With sample_dt, the period of a configured rate, it waits at most two periods for it */
+template <class Bus>
+void sensor_read(Bus &bus, FullScaleRange *range, double sample_dt, bool read_temperature, SensorReading *reading)
+{
+    int raw_accel[3];
+    int raw_gyro[3];
+
+    /* Without the data ready flag the registers may still hold a sample of the old range */
+    if (sample_dt > 0 && sensor_wait_for_sample(bus, 2 * sample_dt))
+        range_data_ready(range);
+    else
+        range_before_read(bus, range);
+    raw_accel[0] = read_word_2c(bus, REGISTER_FOR_ACCEL_XOUT_H);
+    raw_accel[1] = read_word_2c(bus, REGISTER_FOR_ACCEL_YOUT_H);
+    raw_accel[2] = read_word_2c(bus, REGISTER_FOR_ACCEL_ZOUT_H);
+    raw_gyro[0]  = read_word_2c(bus, REGISTER_FOR_GYRO_XOUT_H);
+    raw_gyro[1]  = read_word_2c(bus, REGISTER_FOR_GYRO_YOUT_H);
+    raw_gyro[2]  = read_word_2c(bus, REGISTER_FOR_GYRO_ZOUT_H);
+    if (read_temperature)
+        reading->temp_raw = read_word_2c(bus, REGISTER_FOR_TEMP_OUT_H);
+
+    double accel_factor = range->accel.factor;
+    double gyro_factor  = range->gyro.factor;
+    reading->accX  = raw_accel[0] * accel_factor;
+    reading->accY  = raw_accel[1] * accel_factor;
+    reading->accZ  = raw_accel[2] * accel_factor;
+    reading->gyroX = raw_gyro[0] * gyro_factor;
+    reading->gyroY = raw_gyro[1] * gyro_factor;
+    reading->gyroZ = raw_gyro[2] * gyro_factor;
+    range_after_read(bus, range, raw_accel, raw_gyro);
+}
+
+#endif
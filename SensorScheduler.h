@@ -0,0 +1,295 @@
+/*
+ Coroutines for reading and fusing many sensors on one thread, on the loop of EventLoop.h.
+
+ Each sensor is a coroutine (a Task) written as a plain loop, that suspends where a thread
+ would block: until the time of its next sample (co_await SleepUntil) and until its read
+ on the I2C bus is done (co_await bus.read()). While it is suspended, the loop runs the
+ other sensors. A suspended sensor costs its coroutine frame, a few hundred bytes, where a
+ thread costs a stack and a wake-up through the kernel scheduler.
+
+ The sensors share one bus, which does one transfer at a time, as the I2C adapter of
+ Linux does. SimulatedI2CBus queues the reads and completes each after the time its bytes
+ take on the wire, as a timer of the loop, and then resumes the coroutine that waits
+ for it. On a real bus i2c-dev has no asynchronous transfers: BlockingI2CBus reads in
+ co_await without suspending, which blocks the loop for that time, as it would block the
+ bus for every thread of a thread-per-sensor program.
+
+ Instead of sleeping until a sample is due, a sensor on hardware can wait for its data
+ ready interrupt (co_await pin.wait() of a DataReadyPin), so that it is read as soon as
+ the sensor has the sample, on the clock of the sensor.
+
+ Compile with -std=c++20.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _SensorScheduler_h
+#define _SensorScheduler_h
+
+#include "EventLoop.h"
+#include "SimulatedMpu6050.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <coroutine>
+#include <exception>
+#include <deque>
+
+#define I2C_BITS_PER_BYTE              9     /* 8 data bits and the acknowledge */
+#define I2C_READ_OVERHEAD_BYTES        3     /* Address for the write of the register, register, address for the read */
+#define GPIO_EVENTS_PER_READ           16
+#define GPIO_CONSUMER                  "ito-mpu6050"
+
+/* A coroutine that starts at once, runs until its first suspension, and frees itself when done */
+struct Task {
+    struct promise_type {
+        Task get_return_object() { return Task(); };
+        std::suspend_never initial_suspend() { return std::suspend_never(); };
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); };
+        void return_void() {};
+        void unhandled_exception() { std::terminate(); };
+    };
+};
+
+/* Resumes the coroutine from a callback of the loop */
+void resume_coroutine(void *context)
+{
+    std::coroutine_handle<>::from_address(context).resume();
+}
+
+/* co_await SleepUntil(loop, due) suspends until the due time in seconds of EventLoop::now() */
+struct SleepUntil {
+    EventLoop &loop;
+    double due;
+
+    SleepUntil(EventLoop &loop_, double due_) : loop(loop_), due(due_) {};
+    bool await_ready() { return due <= EventLoop::now(); };
+    void await_suspend(std::coroutine_handle<> waiting) { loop.addTimer(due, resume_coroutine, waiting.address()); };
+    void await_resume() {};
+};
+
+/* One I2C bus shared by simulated sensors, with the time on the wire of a real bus */
+class SimulatedI2CBus {
+public:
+    typedef SimulatedMpu6050 Device;
+    struct Read;
+
+    SimulatedI2CBus(EventLoop &loop_, double clock_hz) : loop(loop_) {
+        byte_seconds = I2C_BITS_PER_BYTE / clock_hz;
+        busy = false;
+        transfers = 0;
+    };
+
+    /* co_await bus.read(sensor, register, data, count) reads count registers from the first on,
+       as one burst transfer, and resumes when the transfer is done. It gives whether the
+       read worked, which it always does here */
+    Read read(SimulatedMpu6050 &sensor, int register_address, unsigned char *data, int count) {
+        return Read(*this, sensor, register_address, data, count);
+    };
+
+    struct Read {
+        SimulatedI2CBus &bus;
+        SimulatedMpu6050 &sensor;
+        int register_address;
+        unsigned char *data;
+        int count;
+        std::coroutine_handle<> waiting;
+
+        Read(SimulatedI2CBus &bus_, SimulatedMpu6050 &sensor_, int register_address_, unsigned char *data_, int count_)
+            : bus(bus_), sensor(sensor_), register_address(register_address_), data(data_), count(count_) {};
+        bool await_ready() { return false; };
+        void await_suspend(std::coroutine_handle<> waiting_) {
+            waiting = waiting_;
+            bus.queue.push_back(this);
+            if (!bus.busy)
+                bus.startNext();
+        };
+        bool await_resume() { return true; };
+    };
+
+    /* Time of a transfer of count registers in seconds */
+    double transferSeconds(int count) { return (I2C_READ_OVERHEAD_BYTES + count) * byte_seconds; };
+    long getTransfers() { return transfers; };
+
+private:
+    void startNext() {
+        if (queue.empty()) {
+            busy = false;
+            return;
+        }
+        busy = true;
+        loop.addTimer(EventLoop::now() + transferSeconds(queue.front()->count), complete, this);
+    };
+    static void complete(void *context) {
+        SimulatedI2CBus &bus = *(SimulatedI2CBus *)context;
+        Read *read = bus.queue.front();
+        bus.queue.pop_front();
+        for (int i = 0; i < read->count; i++)
+            read->data[i] = read->sensor.readReg8(read->register_address + i);
+        bus.transfers++;
+        bus.startNext();
+        read->waiting.resume();
+    };
+
+    EventLoop &loop;
+    double byte_seconds;
+    bool busy;
+    long transfers;
+    std::deque<Read *> queue;
+};
+
+/* The I2C bus of sensors on hardware, one DeviceBus with readBlock() per sensor (I2CDevBus.h).
+   The read is done in await_ready(), so the coroutine goes on without suspending, and the
+   loop is blocked for the transfer */
+template <class DeviceBus>
+class BlockingI2CBus {
+public:
+    typedef DeviceBus Device;
+
+    BlockingI2CBus() { transfers = 0; };
+
+    /* co_await bus.read(device, register, data, count), as for SimulatedI2CBus */
+    struct Read {
+        BlockingI2CBus &bus;
+        DeviceBus &device;
+        int register_address;
+        unsigned char *data;
+        int count;
+        bool done;
+
+        Read(BlockingI2CBus &bus_, DeviceBus &device_, int register_address_, unsigned char *data_, int count_)
+            : bus(bus_), device(device_), register_address(register_address_), data(data_), count(count_) {};
+        bool await_ready() {
+            done = device.readBlock(register_address, data, count);
+            bus.transfers++;
+            return true;
+        };
+        void await_suspend(std::coroutine_handle<>) {};
+        bool await_resume() { return done; };
+    };
+    Read read(DeviceBus &device, int register_address, unsigned char *data, int count) {
+        return Read(*this, device, register_address, data, count);
+    };
+
+    long getTransfers() { return transfers; };
+
+private:
+    long transfers;
+};
+
+/* The data ready interrupt of a sensor on a GPIO line, through the GPIO character device of
+   Linux: the INT pin of the MPU6050 pulses high for every sample once DATA_RDY_EN is set in
+   INT_ENABLE. co_await pin.wait() suspends until the next rising edge and gives its time in
+   seconds of EventLoop::now(), as the kernel stamped the interrupt. When edges came while no
+   coroutine waited, it gives the latest at once */
+class DataReadyPin {
+public:
+    struct Wait;
+
+    DataReadyPin() {
+        fd = -1;
+        pending = false;
+        edge = 0;
+    };
+    ~DataReadyPin() { close(); };
+
+    /* Requests the line of the chip, for example /dev/gpiochip0 and the GPIO number on a Raspberry Pi */
+    bool open(const char *chip_path, int line) {
+        close();
+        int chip = ::open(chip_path, O_RDONLY | O_CLOEXEC);
+        if (chip < 0)
+            return false;
+        struct gpio_v2_line_request request;
+        memset(&request, 0, sizeof(request));
+        request.offsets[0] = line;
+        request.num_lines = 1;
+        request.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING;
+        snprintf(request.consumer, sizeof(request.consumer), "%s", GPIO_CONSUMER);
+        bool requested = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &request) == 0;
+        ::close(chip);
+        if (!requested)
+            return false;
+        fd = request.fd;
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        return true;
+    };
+    bool isOpen() { return fd >= 0; };
+    /* Closing the line also takes it off the loop it was attached to */
+    void close() {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    };
+
+    /* Resumes the waiting coroutine from the loop. The line stays requested when the loop ends */
+    void attach(EventLoop &loop) {
+        waiting = std::coroutine_handle<>();
+        loop.watch(fd, EPOLLIN, readEdges, this);
+    };
+    /* Forgets the edges so far, before a new run */
+    void flush() {
+        takeEdges();
+        pending = false;
+    };
+
+    struct Wait {
+        DataReadyPin &pin;
+
+        Wait(DataReadyPin &pin_) : pin(pin_) {};
+        bool await_ready() { return pin.pending; };
+        void await_suspend(std::coroutine_handle<> waiting_) { pin.waiting = waiting_; };
+        double await_resume() {
+            pin.pending = false;
+            return pin.edge;
+        };
+    };
+    Wait wait() { return Wait(*this); };
+
+    /* For a thread without a loop: blocks until the next edge and returns its time, or -1 when
+       there was none until the deadline in seconds of EventLoop::now() */
+    double waitBlocking(double deadline) {
+        while (!pending) {
+            double left = deadline - EventLoop::now();
+            struct pollfd poll_fd = { fd, POLLIN, 0 };
+            if (left <= 0 || (poll(&poll_fd, 1, (int)ceil(left * 1000)) < 0 && errno != EINTR))
+                return -1;
+            takeEdges();
+        }
+        pending = false;
+        return edge;
+    };
+
+private:
+    void takeEdges() {
+        struct gpio_v2_line_event events[GPIO_EVENTS_PER_READ];
+        ssize_t length;
+        while ((length = read(fd, events, sizeof(events))) > 0) {
+            edge = events[length / sizeof(events[0]) - 1].timestamp_ns / 1e9;
+            pending = true;
+        }
+    };
+    static void readEdges(void *context, uint32_t) {
+        DataReadyPin &pin = *(DataReadyPin *)context;
+        pin.takeEdges();
+        if (pin.pending && pin.waiting) {
+            std::coroutine_handle<> waiting = pin.waiting;
+            pin.waiting = std::coroutine_handle<>();
+            waiting.resume();
+        }
+    };
+
+    int fd;
+    std::coroutine_handle<> waiting;
+    bool pending;
+    double edge;  /* Of the latest edge */
+};
+
+#endif
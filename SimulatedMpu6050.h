@@ -0,0 +1,118 @@
+/*
+ A simulated MPU6050 register file, to run the sensor code without a sensor or I2C bus.
+
+ It is a bus in the sense of WiringPiBus.h (readReg8() and writeReg8()), so any code that
+ is a template over the bus runs against it unchanged. The test code sets the physical
+ state of the sensor (acceleration in g, rates in degrees per second and temperature)
+ and its imperfections (bias and noise). Reading ACCEL_XOUT_H latches a new sample into
+ the output registers, as the real sensor does at its sample rate. The sample includes the
+ offset registers, so code that programs them can be verified against known biases, and
+ follows the full-scale ranges in GYRO_CONFIG and ACCEL_CONFIG, saturating like the sensor.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _SimulatedMpu6050_h
+#define _SimulatedMpu6050_h
+
+#include "Mpu6050.h"
+#include <math.h>
+#include <string.h>
+
+#define SIMULATED_REGISTER_COUNT       128
+
+class SimulatedMpu6050 {
+public:
+    SimulatedMpu6050() {
+        memset(registers, 0, sizeof(registers));
+        registers[REGISTER_FOR_WHO_AM_I] = MPU6050_I2C_DEVICE_ADDRESS;
+        registers[REGISTER_FOR_POWER_MANAGEMENT] = 0x40; // Sleeping after power on
+
+        for (int axis = 0; axis < 3; axis++) {
+            acc_g[axis] = 0;
+            rate_deg_per_sec[axis] = 0;
+            accel_bias_g[axis] = 0;
+            gyro_bias_deg_per_sec[axis] = 0;
+        }
+        acc_g[2] = 1; // Lying flat
+        temp_degrees_c = 25;
+        accel_noise_g = 0;
+        gyro_noise_deg_per_sec = 0;
+        random_state = 0x2545F4914F6CDD1DULL;
+    };
+
+    int readReg8(int register_address) {
+        register_address &= SIMULATED_REGISTER_COUNT - 1;
+        if (register_address == REGISTER_FOR_ACCEL_XOUT_H)
+            latchSample();
+        if (register_address == REGISTER_FOR_INT_STATUS)
+            return registers[REGISTER_FOR_POWER_MANAGEMENT] & 0x40 ? 0 : DATA_READY;
+        return registers[register_address];
+    };
+    void writeReg8(int register_address, int value) {
+        registers[register_address & (SIMULATED_REGISTER_COUNT - 1)] = value & 0xFF;
+    };
+
+    /* Physical state of the sensor */
+    double acc_g[3];
+    double rate_deg_per_sec[3];
+    double temp_degrees_c;
+
+    /* Imperfections of the sensor, before the offset registers */
+    double accel_bias_g[3];
+    double gyro_bias_deg_per_sec[3];
+    double accel_noise_g;
+    double gyro_noise_deg_per_sec;
+
+private:
+    int registerWord(int register_h) {
+        int val = (registers[register_h] << 8) | registers[register_h+1];
+        return val >= 0x8000 ? val - 65536 : val;
+    };
+    void setRegisterWord(int register_h, double value) {
+        int val = (int)lround(value);
+        if (val > 32767)
+            val = 32767;
+        if (val < -32768)
+            val = -32768;
+        write_word_2c(*this, register_h, val);
+    };
+    // Standard normal distributed noise, xorshift and Box-Muller so runs are repeatable
+    double gaussian() {
+        double u1 = (nextRandom() + 1.0) / 4294967297.0;
+        double u2 = (nextRandom() + 1.0) / 4294967297.0;
+        return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+    };
+    unsigned int nextRandom() {
+        random_state ^= random_state >> 12;
+        random_state ^= random_state << 25;
+        random_state ^= random_state >> 27;
+        return (unsigned int)((random_state * 2685821657736338717ULL) >> 32);
+    };
+    void latchSample() {
+        // The full-scale range selected in the config registers, as a multiple of the default range
+        int gyro_range = 1 << ((registers[REGISTER_FOR_GYRO_CONFIG] >> FULL_SCALE_SHIFT) & 3);
+        int accel_range = 1 << ((registers[REGISTER_FOR_ACCEL_CONFIG] >> FULL_SCALE_SHIFT) & 3);
+        for (int axis = 0; axis < 3; axis++) {
+            // Bit 0 of the accel offset registers is reserved and not part of the offset
+            double accel_offset = (registerWord(REGISTER_FOR_XA_OFFS_H + 2*axis) & ~1) / ACCEL_OFFSET_LSB_PER_G;
+            double gyro_offset = registerWord(REGISTER_FOR_XG_OFFS_USRH + 2*axis) / GYRO_OFFSET_LSB_PER_DEG_PER_SEC;
+
+            double acc = acc_g[axis] + accel_bias_g[axis] + accel_noise_g * gaussian() + accel_offset;
+            double rate = rate_deg_per_sec[axis] + gyro_bias_deg_per_sec[axis] + gyro_noise_deg_per_sec * gaussian() + gyro_offset;
+            setRegisterWord(REGISTER_FOR_ACCEL_XOUT_H + 2*axis, acc * ACCEL_LSB_PER_G / accel_range);
+            setRegisterWord(REGISTER_FOR_GYRO_XOUT_H + 2*axis, rate * GYRO_LSB_PER_DEG_PER_SEC / gyro_range);
+        }
+        setRegisterWord(REGISTER_FOR_TEMP_OUT_H, (temp_degrees_c - 36.53) * 340.0);
+    };
+
+    unsigned char registers[SIMULATED_REGISTER_COUNT];
+    unsigned long long random_state;
+};
+
+#endif
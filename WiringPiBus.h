@@ -0,0 +1,31 @@
+/*
+ The I2C bus to the MPU6050 through wiringPiI2C, as used on the Raspberry Pi.
+
+ Code that talks to the sensor is written as a template over the bus, so that the same
+ code runs against the real sensor (this class) and against the simulated register
+ backend in SimulatedMpu6050.h. A bus only needs readReg8() and writeReg8().
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#ifndef _WiringPiBus_h
+#define _WiringPiBus_h
+
+#include <wiringPiI2C.h>
+
+class WiringPiBus {
+public:
+    void setup(int device_address) { handler = wiringPiI2CSetup(device_address); };
+    int readReg8(int register_address) { return wiringPiI2CReadReg8(handler, register_address); };
+    void writeReg8(int register_address, int value) { wiringPiI2CWriteReg8(handler, register_address, value); };
+
+private:
+    int handler;
+};
+
+#endif
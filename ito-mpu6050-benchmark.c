@@ -0,0 +1,1377 @@
+/*
+ Benchmarks for the fusion code in ito-mpu6050-kalman-raspberry.c.
+
+ Runs on any Linux machine, no sensor or wiringPi needed. The data comes from captures
+ recorded with 'ito-mpu6050-kalman-raspberry -w capture.txt' (see Capture.h).
+
+   ito-mpu6050-benchmark engines capture.txt [capture.txt ...]
+   ito-mpu6050-benchmark startup capture.txt
+   ito-mpu6050-benchmark atan
+   ito-mpu6050-benchmark functions
+   ito-mpu6050-benchmark synthetic [model options]
+   ito-mpu6050-benchmark generate static|tilt|vibration|impacts|spin|inverted capture.txt [model options]
+   ito-mpu6050-benchmark golden record capture.txt golden.txt
+   ito-mpu6050-benchmark golden check [capture.txt golden.txt [tolerance_degrees]]
+   ito-mpu6050-benchmark stages
+   ito-mpu6050-benchmark tempmodel
+   ito-mpu6050-benchmark history save history.json commit
+   ito-mpu6050-benchmark history compare history.json [baseline_commit] [stage=percent ...]
+   ito-mpu6050-benchmark columns capture.txt
+   ito-mpu6050-benchmark multirate capture.txt
+   ito-mpu6050-benchmark integration capture.txt
+
+ engines: Replays each capture through every fusion engine and reports the time per
+          update in ns, also when the angles are requested for one in DECIMATED_OUTPUT
+          samples only, and the RMS error of roll and pitch. The error is measured
+          against the true angles when the capture has them, otherwise against the
+          accelerometer-only angles (which is noisy, but the same for all engines).
+
+ startup: Time to a stable estimate after a restart, starting from zero (cold) and from
+          the state saved by a previous run (warm, see FilterState.h). The saved state
+          is the one the Kalman filter has at the end of the capture. Reports the time
+          until the bias first comes within STABLE_BIAS_DEG_PER_SEC of that converged
+          bias, and the time after which the angles stay within STABLE_ANGLE_DEGREES of
+          the true angles (only when known) for the rest of the first
+          STARTUP_WINDOW_SECONDS of the capture.
+
+ columns: Time per sample of the per-sample work of the demonstration program
+          (OutputColumns.h) with the Kalman engine, for all columns and for the Kalman
+          columns only, and the sensor registers it reads per sample with an estimate
+          of their time on the I2C bus, which is where most of the saving is.
+
+ multirate: Accuracy against CPU time of the Kalman engine when the accelerometer
+          corrects at one in 1, 2, 4 ... MAX_CORRECTION_INTERVAL samples (-m), with the
+          accelerometer angles included in the time, as they are only calculated for the
+          samples that correct.
+
+ integration: Accuracy of the integrations of RateIntegration.h when the capture is
+          replayed at 1/1, 1/2 ... 1/MAX_DECIMATION of its sample rate. The gyro is
+          integrated alone from the true angles for INTEGRATION_WINDOW_SECONDS at a time,
+          with the bias of the whole capture removed, and the RMS error at the end of the
+          windows is reported with the time per integration step. The Kalman engine is
+          replayed at the same rates with the Euler and the trapezoidal prediction. Needs
+          a capture with the true angles.
+
+ functions: Time per call of Kalman::getAngle(), predict(), correct() and setAngle() and
+          of the helper math of Mpu6050.h, each in a tight loop over a synthetic
+          trajectory of FUNCTION_TEST_SAMPLES samples, with the CPU cycles and
+          instructions per call from the perf_event hardware counters where the kernel
+          allows them ('-' otherwise). One line per function with whitespace separated
+          columns, after comment lines with the compiler and the build options, so that
+          runs of other compiler flags or filter variants can be compared with diff or awk.
+
+ synthetic: The engines table for each scenario of MotionGenerator.h (static, slow tilt,
+          vibration, impacts, spins and turning upside down), so that accuracy is
+          compared against the time per sample on known motion instead of on a pasted
+          terminal sample.
+
+ generate: Writes the samples of a scenario to a capture with the true angles, for the
+          other subcommands and tools.
+
+          The sensor model of both is set with -s seconds (default SYNTHETIC_SECONDS),
+          -f rate_hz, -b x:y:z gyro bias in degrees per second, -d drift of the gyro
+          bias in degrees per second per degree C, -T start:end temperature in degree C,
+          -n gyro_noise:accel_noise in degrees per second and g, and -g and -r for the
+          full-scale ranges, which the samples saturate at (see sensor_model_default()).
+
+ golden:  Regression check of optimized code (see GoldenReplay.h). 'record' replays the
+          capture through every engine and configuration of the engines table and
+          stores their outputs. 'check' replays it again with the code as it is now,
+          and reports per engine whether the outputs are bit for bit the same (exact),
+          differ by at most the tolerance (within) or more (FAIL), the largest
+          difference, and ns/update, so that a speed-up is only taken together with
+          its accuracy. Without a tolerance only exact outputs pass. Exits with 1 when
+          an engine fails or is missing from the golden file. Without files, 'check'
+          uses GOLDEN_CAPTURE_PATH and GOLDEN_PATH, a short capture of the spin
+          scenario and its golden outputs kept with the source, where roll crosses ±90
+          and ±180 degrees. They are recorded with FAST_ATAN, as the program runs, and
+          checked within GOLDEN_TOLERANCE_DEGREES: a compiler that contracts a * b + c
+          into a fused multiply-add (GCC on aarch64, or -march with FMA on x86) rounds
+          the last bits differently. The exact check is for outputs recorded with the
+          same compiler and flags.
+
+ stages:  CPU time per sample in ns of the stages of the loop of PerfHistory.h: the
+          read of the program on the simulated bus, the accelerometer angles, the Kalman
+          engine and the printing of a line of all columns into a buffer, each the
+          fastest of STAGE_REPEATS runs in each of STAGE_ROUNDS rounds to keep the
+          noise down.
+
+ history: 'save' measures the stages and appends them for the commit to a JSON history.
+          'compare' compares the latest record against the record of the baseline
+          commit (by default the one before it), and flags each stage that got slower
+          than its budget, PERF_BUDGET_PERCENT unless given per stage, for example
+          get_angle=5. Exits with 1 on a regression.
+
+ tempmodel: Replays TEMP_MODEL_CHECK_SECONDS of the inverted scenario, where the board
+          is upside down half of the time, and learns the gyro temperature model from the
+          Kalman bias as the program does with -t. Prints the learned offset of each axis
+          against the simulated gyro bias, and exits with 1 when the restricted axis, whose
+          rate the engine negates while upside down, is off by more than
+          TEMP_MODEL_CHECK_TOLERANCE.
+
+ atan:    Checks every polynomial of FastAtan.h against libm over ATAN_TEST_POINTS
+          directions and random accelerometer vectors, and reports the maximum error
+          and the time per sample of libm, of the polynomial called per sample and of
+          the batch function. Exits with 1 when a polynomial exceeds its documented error.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+/* Same convention and angle math as ito-mpu6050-kalman-raspberry.c, so the engines are timed
+   and the golden outputs checked on the code that runs on the device */
+#define PITCH_RESTRICT_90_DEG
+#define FAST_ATAN
+
+#include "FusionEngine.h"
+#include "Capture.h"
+#include "FilterState.h"
+#include "OutputColumns.h"
+#include "MotionGenerator.h"
+#include "GoldenReplay.h"
+#include "PerfHistory.h"
+#include "SensorBus.h"
+#include "SensorRead.h"
+#include "GyroTempModel.h"
+
+#define MIN_BENCHMARK_SECONDS          0.5
+#define STARTUP_WINDOW_SECONDS         10.0
+#define STABLE_BIAS_DEG_PER_SEC        0.1
+#define STABLE_ANGLE_DEGREES           1.0
+#define ATAN_TEST_POINTS               100000
+#define DECIMATED_OUTPUT               10    /* Angles requested for one in this many samples */
+#define DECIMATED_OUTPUT_TEXT          "10"
+#define MAX_CORRECTION_INTERVAL        16
+#define MAX_DECIMATION                 8
+#define INTEGRATION_WINDOW_SECONDS     1.0
+#define FUNCTION_TEST_SAMPLES          1000  /* 5 s at 200 Hz, small enough to stay in the L1 cache */
+#define SYNTHETIC_SECONDS              60.0
+#define STAGE_SECONDS                  10.0  /* Of the tilt scenario, as input of the stages */
+#define GOLDEN_CAPTURE_PATH            "golden-spin-capture.txt" /* generate spin golden-spin-capture.txt -s 5 */
+#define GOLDEN_PATH                    "golden-spin.txt"
+#define GOLDEN_TOLERANCE_DEGREES       1e-9  /* Of the check without files, for compilers that contract to FMA */
+#define STAGE_REPEATS                  20    /* Short runs, so that the fastest is one without an interruption */
+#define STAGE_ROUNDS                   3     /* Of all stages one after the other */
+#define STAGE_TRANSACTION_US           0     /* Of the simulated bus of the i2c_read stage, see measure_stages() */
+#define TEMP_MODEL_CHECK_SECONDS       120.0
+#define TEMP_MODEL_CHECK_TOLERANCE     0.03  /* Degrees per second, of the restricted axis */
+#define I2C_REGISTER_READ_US           400   /* One readReg8() at 100 kHz: address, register, address again and data, 9 bits each */
+
+/* Defeats dead code elimination of the benchmarked results */
+volatile double benchmark_sink;
+
+double now_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* A capture converted once up front, so that only the engine itself is timed */
+struct Replay {
+    std::vector<ImuSample> samples;
+    std::vector<double>    t_us;
+    std::vector<double>    dt;
+    std::vector<double>    roll_reference;
+    std::vector<double>    pitch_reference;
+    bool                   has_truth;
+};
+
+void replay_from_records(const std::vector<CaptureRecord> &records, Replay *replay)
+{
+    replay->has_truth = true;
+    for (size_t i = 0; i < records.size(); i++)
+        replay->has_truth = replay->has_truth && records[i].has_truth;
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        ImuSample sample = imu_sample_from_raw(records[i].accX, records[i].accY, records[i].accZ,
+                                               records[i].gyroX, records[i].gyroY, records[i].gyroZ);
+        replay->samples.push_back(sample);
+        replay->t_us.push_back(records[i].t_us - records[0].t_us);
+        replay->dt.push_back(i == 0 ? 0 : (records[i].t_us - records[i-1].t_us) / 1000000);
+        replay->roll_reference.push_back(replay->has_truth ? records[i].roll_true : sample.roll);
+        replay->pitch_reference.push_back(replay->has_truth ? records[i].pitch_true : sample.pitch);
+    }
+}
+
+bool load_replay(const char *path, Replay *replay)
+{
+    std::vector<CaptureRecord> records;
+    if (!capture_load(path, &records) || records.size() < 2)
+        return false;
+    replay_from_records(records, replay);
+    return true;
+}
+
+/* Difference between two angles, wrapped to ±180 degrees */
+double angle_error(double a, double b)
+{
+    return fmod(a - b + 540.0, 360.0) - 180.0;
+}
+
+/* Time per update in ns over as many passes as fit in the minimum time, with the angles of one in output_every samples */
+template <class Engine>
+double time_engine(const Replay &replay, Engine configured, size_t output_every)
+{
+    size_t count = replay.samples.size();
+    long updates = 0;
+    double start = now_seconds();
+    double seconds;
+    double roll;
+    double pitch;
+    do
+    {
+        Engine timed = configured;
+        timed.setAngle(replay.samples[0].roll, replay.samples[0].pitch);
+        for (size_t i = 1; i < count; i++)
+        {
+            timed.update(replay.samples[i], replay.dt[i]);
+            if (i % output_every == 0)
+            {
+                timed.getAngles(&roll, &pitch);
+                benchmark_sink = roll + pitch;
+            }
+        }
+        updates += count - 1;
+        seconds = now_seconds() - start;
+    } while (seconds < MIN_BENCHMARK_SECONDS);
+    return seconds * 1e9 / updates;
+}
+
+template <class Engine>
+void benchmark_engine(const Replay &replay, const char *label, Engine configured = Engine())
+{
+    size_t count = replay.samples.size();
+    double roll;
+    double pitch;
+
+    /* One pass for the accuracy */
+    double roll_squared  = 0;
+    double pitch_squared = 0;
+    Engine engine = configured;
+    engine.setAngle(replay.samples[0].roll, replay.samples[0].pitch);
+    for (size_t i = 1; i < count; i++)
+    {
+        engine.getAngle(replay.samples[i], replay.dt[i], &roll, &pitch);
+        roll_squared  += pow(angle_error(roll, replay.roll_reference[i]), 2);
+        pitch_squared += pow(angle_error(pitch, replay.pitch_reference[i]), 2);
+    }
+
+    /* The speed with the angles of every sample and with the angles of every DECIMATED_OUTPUT-th sample only */
+    double ns_per_update[2];
+    ns_per_update[0] = time_engine(replay, configured, 1);
+    ns_per_update[1] = time_engine(replay, configured, DECIMATED_OUTPUT);
+
+    printf("%-20s %10.1f %13.1f %12.3f %12.3f\n", label, ns_per_update[0], ns_per_update[1],
+           sqrt(roll_squared / (count - 1)), sqrt(pitch_squared / (count - 1)));
+}
+
+/* Calls visit(label, engine) for every engine, and for the Kalman engine in each of its configurations */
+template <class Visit>
+void for_all_engines(Visit visit)
+{
+    KalmanEngine adaptive;
+    adaptive.setAdaptive(true);
+    KalmanEngine trapezoidal;
+    trapezoidal.setIntegration(INTEGRATE_TRAPEZOIDAL);
+    KalmanEngine correct_4;
+    correct_4.setCorrectionInterval(4);
+
+    visit("kalman", KalmanEngine());
+    visit("kalman adaptive", adaptive);
+    visit("kalman trapezoidal", trapezoidal);
+    visit("kalman -m 4", correct_4);
+    visit("complementary", ComplementaryEngine());
+    visit("madgwick", MadgwickEngine());
+    visit("mahony", MahonyEngine());
+    visit("gravity", GravityEngine());
+}
+
+void benchmark_all_engines(const Replay &replay)
+{
+    printf("%-20s %10s %13s %12s %12s\n", "engine", "ns/update", "ns/update_d" DECIMATED_OUTPUT_TEXT, "rms_roll", "rms_pitch");
+    for_all_engines([&](const char *label, auto configured) {
+        benchmark_engine(replay, label, configured);
+    });
+}
+
+int benchmark_engines(int captures, char *paths[])
+{
+    for (int c = 0; c < captures; c++)
+    {
+        Replay replay;
+        if (!load_replay(paths[c], &replay))
+        {
+            fprintf(stderr, "%s: cannot read capture\n", paths[c]);
+            return 1;
+        }
+        printf("# %s: %zu samples, error against %s\n", paths[c], replay.samples.size(),
+               replay.has_truth ? "true angles" : "accelerometer angles");
+        benchmark_all_engines(replay);
+    }
+    return 0;
+}
+
+/* Replays the start of a capture and returns the times in ms until the bias converges and the angles stay stable */
+void time_to_stable(const Replay &replay, const FilterStateEntry *saved, const FilterStateEntry &converged,
+                    double *bias_converged_ms, double *angle_stable_ms)
+{
+    KalmanEngine engine;
+    FilterStateEntry state;
+    double roll, pitch;
+
+    engine.setAngle(replay.samples[0].roll, replay.samples[0].pitch);
+    if (saved)
+        kalman_engine_set_state(engine, *saved);
+
+    bool bias_converged = saved != NULL;
+    *bias_converged_ms = saved ? 0 : STARTUP_WINDOW_SECONDS * 1000;
+    *angle_stable_ms   = 0;
+    for (size_t i = 1; i < replay.samples.size() && replay.t_us[i] < STARTUP_WINDOW_SECONDS * 1e6; i++)
+    {
+        engine.getAngle(replay.samples[i], replay.dt[i], &roll, &pitch);
+        kalman_engine_get_state(engine, &state);
+        if (!bias_converged &&
+            fabs(state.roll.bias - converged.roll.bias) <= STABLE_BIAS_DEG_PER_SEC &&
+            fabs(state.pitch.bias - converged.pitch.bias) <= STABLE_BIAS_DEG_PER_SEC)
+        {
+            bias_converged     = true;
+            *bias_converged_ms = replay.t_us[i] / 1000;
+        }
+        if (fabs(angle_error(roll, replay.roll_reference[i])) > STABLE_ANGLE_DEGREES ||
+            fabs(angle_error(pitch, replay.pitch_reference[i])) > STABLE_ANGLE_DEGREES)
+            *angle_stable_ms = replay.t_us[i] / 1000;
+    }
+}
+
+int benchmark_startup(const char *path)
+{
+    Replay replay;
+    if (!load_replay(path, &replay))
+    {
+        fprintf(stderr, "%s: cannot read capture\n", path);
+        return 1;
+    }
+
+    /* The state a previous run would have saved on exit */
+    KalmanEngine engine;
+    FilterStateEntry converged;
+    double roll, pitch;
+    engine.setAngle(replay.samples[0].roll, replay.samples[0].pitch);
+    for (size_t i = 1; i < replay.samples.size(); i++)
+        engine.getAngle(replay.samples[i], replay.dt[i], &roll, &pitch);
+    kalman_engine_get_state(engine, &converged);
+
+    double cold_bias_ms, cold_angle_ms, warm_bias_ms, warm_angle_ms;
+    time_to_stable(replay, NULL, converged, &cold_bias_ms, &cold_angle_ms);
+    time_to_stable(replay, &converged, converged, &warm_bias_ms, &warm_angle_ms);
+
+    printf("# %s: converged bias roll %.3f pitch %.3f deg/s\n", path, converged.roll.bias, converged.pitch.bias);
+    printf("%-6s %18s %16s\n", "start", "bias_converged_ms", "angle_stable_ms");
+    if (replay.has_truth)
+    {
+        printf("%-6s %18.1f %16.1f\n", "cold", cold_bias_ms, cold_angle_ms);
+        printf("%-6s %18.1f %16.1f\n", "warm", warm_bias_ms, warm_angle_ms);
+    }
+    else
+    {
+        printf("%-6s %18.1f %16s\n", "cold", cold_bias_ms, "-");
+        printf("%-6s %18.1f %16s\n", "warm", warm_bias_ms, "-");
+    }
+    return 0;
+}
+
+/* Time per sample in ns of columns_update() over the replay with the columns selected */
+double time_columns(const Replay &replay, int selected, KalmanEngine configured = KalmanEngine())
+{
+    size_t count = replay.samples.size();
+    long updates = 0;
+    double start = now_seconds();
+    double seconds;
+    do
+    {
+        KalmanEngine engine = configured;
+        OutputColumns columns;
+        engine.setAngle(replay.samples[0].roll, replay.samples[0].pitch);
+        columns_start(&columns, selected, replay.samples[0].roll, replay.samples[0].pitch);
+        for (size_t i = 1; i < count; i++)
+        {
+            const ImuSample &sample = replay.samples[i];
+            columns_update(&columns, engine, sample, sample.roll_rate, sample.pitch_rate, replay.dt[i], true);
+            benchmark_sink = columns.roll_fused + columns.pitch_fused;
+        }
+        updates += count - 1;
+        seconds = now_seconds() - start;
+    } while (seconds < MIN_BENCHMARK_SECONDS);
+    return seconds * 1e9 / updates;
+}
+
+int benchmark_columns(const char *path)
+{
+    Replay replay;
+    if (!load_replay(path, &replay))
+    {
+        fprintf(stderr, "%s: cannot read capture\n", path);
+        return 1;
+    }
+
+    /* Accel and gyro X, Y, Z, and TEMP_OUT when the temperature is printed (no -t, -s or -w) */
+    printf("# %s: %zu samples, kalman engine\n", path, replay.samples.size());
+    printf("%-16s %10s %16s %14s\n", "columns", "ns/sample", "registers/sample", "i2c_us/sample");
+    printf("%-16s %10.1f %16d %14d\n", "all", time_columns(replay, COLUMN_ALL), 2 * 7, 2 * 7 * I2C_REGISTER_READ_US);
+    printf("%-16s %10.1f %16d %14d\n", "fused", time_columns(replay, COLUMN_FUSED), 2 * 6, 2 * 6 * I2C_REGISTER_READ_US);
+    return 0;
+}
+
+int benchmark_multirate(const char *path)
+{
+    Replay replay;
+    if (!load_replay(path, &replay))
+    {
+        fprintf(stderr, "%s: cannot read capture\n", path);
+        return 1;
+    }
+
+    size_t count = replay.samples.size();
+    printf("# %s: %zu samples, error against %s\n", path, count, replay.has_truth ? "true angles" : "accelerometer angles");
+    printf("%-10s %10s %12s %12s\n", "interval", "ns/sample", "rms_roll", "rms_pitch");
+    for (int interval = 1; interval <= MAX_CORRECTION_INTERVAL; interval *= 2)
+    {
+        KalmanEngine configured;
+        configured.setCorrectionInterval(interval);
+
+        KalmanEngine engine = configured;
+        OutputColumns columns;
+        double roll_squared  = 0;
+        double pitch_squared = 0;
+        engine.setAngle(replay.samples[0].roll, replay.samples[0].pitch);
+        columns_start(&columns, COLUMN_FUSED, replay.samples[0].roll, replay.samples[0].pitch);
+        for (size_t i = 1; i < count; i++)
+        {
+            const ImuSample &sample = replay.samples[i];
+            columns_update(&columns, engine, sample, sample.roll_rate, sample.pitch_rate, replay.dt[i], true);
+            roll_squared  += pow(angle_error(columns.roll_fused, replay.roll_reference[i]), 2);
+            pitch_squared += pow(angle_error(columns.pitch_fused, replay.pitch_reference[i]), 2);
+        }
+        printf("%-10d %10.1f %12.3f %12.3f\n", interval, time_columns(replay, COLUMN_FUSED, configured),
+               sqrt(roll_squared / (count - 1)), sqrt(pitch_squared / (count - 1)));
+    }
+    return 0;
+}
+
+/* The replay with one in every factor samples, as if the sensor had been read at a lower rate */
+void decimate_replay(const Replay &replay, int factor, Replay *decimated)
+{
+    decimated->has_truth = replay.has_truth;
+    for (size_t i = 0; i < replay.samples.size(); i += factor)
+    {
+        decimated->samples.push_back(replay.samples[i]);
+        decimated->t_us.push_back(replay.t_us[i]);
+        decimated->dt.push_back(i == 0 ? 0 : (replay.t_us[i] - replay.t_us[i - factor]) / 1000000);
+        decimated->roll_reference.push_back(replay.roll_reference[i]);
+        decimated->pitch_reference.push_back(replay.pitch_reference[i]);
+    }
+}
+
+/* Constant gyro bias of one axis: the integrated rate less the change of the true angle, over the capture */
+double capture_rate_bias(const Replay &replay, bool pitch)
+{
+    size_t last = replay.samples.size() - 1;
+    double integrated = 0;
+    for (size_t i = 1; i <= last; i++)
+    {
+        double rate          = pitch ? replay.samples[i].pitch_rate : replay.samples[i].roll_rate;
+        double previous_rate = pitch ? replay.samples[i-1].pitch_rate : replay.samples[i-1].roll_rate;
+        integrated += replay.dt[i] * (rate + previous_rate) / 2;
+    }
+    const std::vector<double> &reference = pitch ? replay.pitch_reference : replay.roll_reference;
+    return (integrated - angle_error(reference[last], reference[0])) / (replay.t_us[last] / 1000000);
+}
+
+/* RMS error in degrees of the gyro integrated from the true angle over windows, and the time per step in ns */
+void integrate_windows(const Replay &replay, RateIntegration method, double roll_bias, double pitch_bias,
+                       double *roll_rms, double *pitch_rms, double *ns_per_step)
+{
+    size_t count = replay.samples.size();
+    RateHistory roll_history;
+    RateHistory pitch_history;
+    rate_history_reset(&roll_history);
+    rate_history_reset(&pitch_history);
+
+    double roll           = replay.roll_reference[0];
+    double pitch          = replay.pitch_reference[0];
+    double window_start   = 0;
+    double roll_squared   = 0;
+    double pitch_squared  = 0;
+    int windows           = 0;
+    for (size_t i = 1; i < count; i++)
+    {
+        roll  += integrate_rate(&roll_history, method, replay.samples[i].roll_rate - roll_bias, replay.dt[i]);
+        pitch += integrate_rate(&pitch_history, method, replay.samples[i].pitch_rate - pitch_bias, replay.dt[i]);
+        if (replay.t_us[i] - window_start >= INTEGRATION_WINDOW_SECONDS * 1000000)
+        {
+            roll_squared  += pow(angle_error(roll, replay.roll_reference[i]), 2);
+            pitch_squared += pow(angle_error(pitch, replay.pitch_reference[i]), 2);
+            windows++;
+            roll         = replay.roll_reference[i];
+            pitch        = replay.pitch_reference[i];
+            window_start = replay.t_us[i];
+        }
+    }
+    *roll_rms  = windows ? sqrt(roll_squared / windows) : 0;
+    *pitch_rms = windows ? sqrt(pitch_squared / windows) : 0;
+
+    long steps = 0;
+    double start = now_seconds();
+    double seconds;
+    do
+    {
+        double angle = 0;
+        rate_history_reset(&roll_history);
+        for (size_t i = 1; i < count; i++)
+            angle += integrate_rate(&roll_history, method, replay.samples[i].roll_rate, replay.dt[i]);
+        benchmark_sink = angle;
+        steps += count - 1;
+        seconds = now_seconds() - start;
+    } while (seconds < MIN_BENCHMARK_SECONDS);
+    *ns_per_step = seconds * 1e9 / steps;
+}
+
+/* RMS error of roll and pitch of the Kalman engine over the replay */
+void kalman_rms(const Replay &replay, RateIntegration method, double *roll_rms, double *pitch_rms)
+{
+    size_t count = replay.samples.size();
+    KalmanEngine engine;
+    double roll;
+    double pitch;
+    double roll_squared  = 0;
+    double pitch_squared = 0;
+    engine.setIntegration(method);
+    engine.setAngle(replay.samples[0].roll, replay.samples[0].pitch);
+    for (size_t i = 1; i < count; i++)
+    {
+        engine.getAngle(replay.samples[i], replay.dt[i], &roll, &pitch);
+        roll_squared  += pow(angle_error(roll, replay.roll_reference[i]), 2);
+        pitch_squared += pow(angle_error(pitch, replay.pitch_reference[i]), 2);
+    }
+    *roll_rms  = sqrt(roll_squared / (count - 1));
+    *pitch_rms = sqrt(pitch_squared / (count - 1));
+}
+
+int benchmark_integration(const char *path)
+{
+    Replay replay;
+    if (!load_replay(path, &replay))
+    {
+        fprintf(stderr, "%s: cannot read capture\n", path);
+        return 1;
+    }
+    if (!replay.has_truth)
+    {
+        fprintf(stderr, "%s: the capture has no true angles\n", path);
+        return 1;
+    }
+
+    double roll_bias  = capture_rate_bias(replay, false);
+    double pitch_bias = capture_rate_bias(replay, true);
+    printf("# %s: %zu samples at %.0f Hz, gyro bias %.3f %.3f deg/s\n", path, replay.samples.size(),
+           (replay.samples.size() - 1) / (replay.t_us.back() / 1000000), roll_bias, pitch_bias);
+    printf("%-10s %-12s %10s %12s %12s %12s %12s\n", "rate", "integration", "ns/step",
+           "gyro_roll", "gyro_pitch", "kalman_roll", "kalman_pitch");
+    for (int factor = 1; factor <= MAX_DECIMATION; factor *= 2)
+    {
+        Replay decimated;
+        decimate_replay(replay, factor, &decimated);
+        char rate[16];
+        snprintf(rate, sizeof(rate), "1/%d", factor);
+        for (int method = 0; method < RATE_INTEGRATION_COUNT; method++)
+        {
+            double gyro_roll, gyro_pitch, ns_per_step, kalman_roll, kalman_pitch;
+            integrate_windows(decimated, (RateIntegration)method, roll_bias, pitch_bias, &gyro_roll, &gyro_pitch, &ns_per_step);
+            kalman_rms(decimated, (RateIntegration)method, &kalman_roll, &kalman_pitch);
+            printf("%-10s %-12s %10.1f %12.4f %12.4f %12.3f %12.3f\n", rate, rate_integration_names[method],
+                   ns_per_step, gyro_roll, gyro_pitch, kalman_roll, kalman_pitch);
+        }
+    }
+    return 0;
+}
+
+/* Test vectors for the angle functions: a full circle of directions with varying length */
+struct AtanInput {
+    std::vector<double> a;
+    std::vector<double> b;
+    std::vector<double> c;
+};
+
+void make_atan_input(AtanInput *input)
+{
+    srand(1);
+    for (int i = 0; i < ATAN_TEST_POINTS; i++)
+    {
+        double direction = 2 * M_PI * i / ATAN_TEST_POINTS;
+        double length    = ACCEL_LSB_PER_G * (0.1 + 3.0 * rand() / RAND_MAX);
+        input->a.push_back(length * sin(direction));
+        input->b.push_back(length * cos(direction));
+        input->c.push_back(ACCEL_LSB_PER_G * (2.0 * rand() / RAND_MAX - 1));
+    }
+    // The axes and the origin, where the octant reduction has its edges
+    double edges[][2] = { { 0, 0 }, { 0, 1 }, { 1, 0 }, { 0, -1 }, { -1, 0 }, { 1, 1 }, { -1, -1 } };
+    for (unsigned int i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+    {
+        input->a.push_back(edges[i][0]);
+        input->b.push_back(edges[i][1]);
+        input->c.push_back(0);
+    }
+}
+
+/* The libm reference, whether or not atan2_deg() and atan_deg() use the polynomials (FAST_ATAN) */
+double libm_atan2_deg(double a, double b)
+{
+    return atan2(a, b) * RAD_TO_DEG;
+}
+
+double libm_atan_deg(double a, double b, double c)
+{
+    return atan(a / distance(b, c)) * RAD_TO_DEG;
+}
+
+/* Time per sample in ns of an angle function over the input, repeated for the minimum time */
+template <class Function>
+double time_per_sample(const AtanInput &input, Function function)
+{
+    long samples = 0;
+    double start = now_seconds();
+    double seconds;
+    do
+    {
+        function();
+        samples += input.a.size();
+        seconds = now_seconds() - start;
+    } while (seconds < MIN_BENCHMARK_SECONDS);
+    return seconds * 1e9 / samples;
+}
+
+template <int set>
+bool benchmark_atan_set(const AtanInput &input)
+{
+    size_t count = input.a.size();
+    std::vector<double> angle(count);
+
+    double max_error = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        double error2 = fabs(angle_error(fast_atan2_deg<set>(input.a[i], input.b[i]), libm_atan2_deg(input.a[i], input.b[i])));
+        double error  = fabs(fast_atan_deg<set>(input.a[i], input.b[i], input.c[i]) - libm_atan_deg(input.a[i], input.b[i], input.c[i]));
+        max_error = fmax(max_error, fmax(error, error2));
+    }
+
+    double scalar_ns = time_per_sample(input, [&]() {
+        for (size_t i = 0; i < count; i++)
+            benchmark_sink = fast_atan2_deg<set>(input.a[i], input.b[i]);
+    });
+    double batch_ns = time_per_sample(input, [&]() {
+        fast_atan2_deg_batch<set>(&input.a[0], &input.b[0], &angle[0], count);
+        benchmark_sink = angle[count - 1];
+    });
+
+    bool within = max_error <= fast_atan_error_degrees[set];
+    printf("%-6d %14.7f %14.7f %10.2f %10.2f %s\n", set + 2, max_error, fast_atan_error_degrees[set],
+           scalar_ns, batch_ns, within ? "ok" : "FAIL");
+    return within;
+}
+
+/* Learns the temperature model from the Kalman bias over the inverted scenario, as the
+   program does with -t, and compares the learned offsets with the simulated gyro bias. Only
+   the restricted axis is checked: its rate is negated while the board is upside down. The
+   free axis is set from the accelerometer then, and lags behind after each turn */
+int benchmark_tempmodel()
+{
+    SensorModel model;
+    sensor_model_default(&model);
+    model.temp_end_c = model.temp_start_c;
+    std::vector<CaptureRecord> records;
+    motion_generate(MOTION_INVERTED, model, TEMP_MODEL_CHECK_SECONDS, &records);
+
+    GyroTempModel temp_model;
+    temp_model_reset(&temp_model);
+    KalmanEngine engine;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        double temp_degrees_c = convert_to_degrees_c(records[i].temp_raw);
+        ImuSample sample = imu_sample_from_raw(records[i].accX, records[i].accY, records[i].accZ,
+                                               records[i].gyroX, records[i].gyroY, records[i].gyroZ);
+        sample.roll_rate  -= temp_model_bias(&temp_model, 0, temp_degrees_c);
+        sample.pitch_rate -= temp_model_bias(&temp_model, 1, temp_degrees_c);
+        if (i == 0)
+            engine.setAngle(sample.roll, sample.pitch);
+        else
+            engine.update(sample, 1 / model.rate_hz);
+        if (i % TEMP_MODEL_UPDATE_SAMPLES == 0)
+            temp_model_learn(&temp_model, temp_degrees_c, engine);
+    }
+
+    int restricted = KalmanEngine::convention == PITCH_RESTRICTED ? 1 : 0;
+    printf("%-6s %12s %12s %12s\n", "axis", "true_dps", "learned_dps", "error_dps");
+    bool within = true;
+    for (int axis = 0; axis < 2; axis++)
+    {
+        double learned = temp_model_bias(&temp_model, axis, model.temp_start_c);
+        double error   = learned - model.gyro_bias_deg_per_sec[axis];
+        printf("%-6s %12.3f %12.3f %12.3f%s\n", axis == 0 ? "roll" : "pitch", model.gyro_bias_deg_per_sec[axis], learned, error,
+               axis == restricted ? "  (checked)" : "");
+        if (axis == restricted)
+            within = fabs(error) <= TEMP_MODEL_CHECK_TOLERANCE;
+    }
+    return within ? 0 : 1;
+}
+
+int benchmark_atan()
+{
+    AtanInput input;
+    make_atan_input(&input);
+    size_t count = input.a.size();
+
+    double libm_ns = time_per_sample(input, [&]() {
+        for (size_t i = 0; i < count; i++)
+            benchmark_sink = libm_atan2_deg(input.a[i], input.b[i]);
+    });
+    printf("# libm atan2: %.2f ns/sample\n", libm_ns);
+    printf("%-6s %14s %14s %10s %10s\n", "terms", "max_error_deg", "bound_deg", "ns/sample", "ns/batch");
+
+    bool within = benchmark_atan_set<0>(input);
+    within = benchmark_atan_set<1>(input) && within;
+    within = benchmark_atan_set<2>(input) && within;
+    within = benchmark_atan_set<3>(input) && within;
+    within = benchmark_atan_set<4>(input) && within;
+    within = benchmark_atan_set<5>(input) && within;
+    return within ? 0 : 1;
+}
+
+/* CPU cycles and instructions of this process in user space, see perf_event_open(2).
+   A counter is -1 when the kernel does not allow it (perf_event_paranoid, containers) */
+struct PerfCounters {
+    int cycles;
+    int instructions;
+};
+
+int perf_counter_open(unsigned long long config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = config;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void perf_counters_open(PerfCounters *counters)
+{
+    counters->cycles       = perf_counter_open(PERF_COUNT_HW_CPU_CYCLES);
+    counters->instructions = perf_counter_open(PERF_COUNT_HW_INSTRUCTIONS);
+}
+
+void perf_counter_start(int counter)
+{
+    if (counter < 0)
+        return;
+    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+/* The count since perf_counter_start(), or -1 */
+double perf_counter_stop(int counter)
+{
+    unsigned long long count;
+    if (counter < 0)
+        return -1;
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter, &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return (double)count;
+}
+
+/* The inputs of the functions along a synthetic trajectory: roll and pitch swinging at
+   different frequencies, with sensor noise, in the units of ImuSample */
+struct FunctionInput {
+    std::vector<double> accX;
+    std::vector<double> accY;
+    std::vector<double> accZ;
+    std::vector<double> roll;        /* Accelerometer angles */
+    std::vector<double> roll_rate;
+    std::vector<double> roll_gyro;   /* Integrated gyro, to correct for drift */
+    std::vector<double> roll_fused;  /* Beyond ±90 degrees now and then */
+    double dt;
+};
+
+void make_function_input(FunctionInput *input)
+{
+    srand(1);
+    input->dt = 0.005;
+    double roll_gyro = 0;
+    for (int i = 0; i < FUNCTION_TEST_SAMPLES; i++)
+    {
+        double t     = i * input->dt;
+        double roll  = 120 * sin(2 * M_PI * 0.5 * t);
+        double pitch = 20 * sin(2 * M_PI * 0.7 * t + 1);
+        double noise = 100.0 / RAND_MAX;
+        input->accX.push_back(-sin(pitch / RAD_TO_DEG) * ACCEL_LSB_PER_G + noise * (rand() - RAND_MAX / 2));
+        input->accY.push_back(sin(roll / RAD_TO_DEG) * cos(pitch / RAD_TO_DEG) * ACCEL_LSB_PER_G + noise * (rand() - RAND_MAX / 2));
+        input->accZ.push_back(cos(roll / RAD_TO_DEG) * cos(pitch / RAD_TO_DEG) * ACCEL_LSB_PER_G + noise * (rand() - RAND_MAX / 2));
+        input->roll.push_back(atan2_deg(input->accY[i], input->accZ[i]));
+        input->roll_rate.push_back(120 * 2 * M_PI * 0.5 * cos(2 * M_PI * 0.5 * t) + 1.0);
+        roll_gyro += input->roll_rate[i] * input->dt;
+        input->roll_gyro.push_back(roll_gyro);
+        input->roll_fused.push_back(roll);
+    }
+}
+
+/* Runs the function over all samples for the minimum time, and prints the time, cycles
+   and instructions per call. The function stores its result for sample i in output[i] */
+template <class Function>
+void benchmark_function(const char *name, const PerfCounters &counters, std::vector<double> &output, Function function)
+{
+    long calls = 0;
+    double start = now_seconds();
+    double seconds;
+    perf_counter_start(counters.cycles);
+    perf_counter_start(counters.instructions);
+    do
+    {
+        for (int i = 0; i < FUNCTION_TEST_SAMPLES; i++)
+            function(i);
+        benchmark_sink = output[FUNCTION_TEST_SAMPLES - 1];
+        calls += FUNCTION_TEST_SAMPLES;
+        seconds = now_seconds() - start;
+    } while (seconds < MIN_BENCHMARK_SECONDS);
+    double cycles       = perf_counter_stop(counters.cycles);
+    double instructions = perf_counter_stop(counters.instructions);
+
+    printf("%-24s %10.2f", name, seconds * 1e9 / calls);
+    if (cycles >= 0)
+        printf(" %12.1f", cycles / calls);
+    else
+        printf(" %12s", "-");
+    if (instructions >= 0)
+        printf(" %14.1f\n", instructions / calls);
+    else
+        printf(" %14s\n", "-");
+}
+
+int benchmark_functions()
+{
+    FunctionInput input;
+    PerfCounters counters;
+    make_function_input(&input);
+    perf_counters_open(&counters);
+    std::vector<double> output(FUNCTION_TEST_SAMPLES);
+    const FunctionInput &in = input;
+
+#ifdef __OPTIMIZE__
+    const char *optimized = "yes";
+#else
+    const char *optimized = "no";
+#endif
+#ifdef FAST_ATAN
+    const char *fast_atan = "yes";
+#else
+    const char *fast_atan = "no";
+#endif
+    printf("# compiler: %s\n", __VERSION__);
+    printf("# optimized: %s, fast_atan: %s, samples: %d, counters: %s\n", optimized, fast_atan, FUNCTION_TEST_SAMPLES,
+           counters.cycles >= 0 ? "perf_event" : "none");
+    printf("%-24s %10s %12s %14s\n", "function", "ns/call", "cycles/call", "instructions/call");
+
+    /* The filter state carries over from call to call, as in the program */
+    Kalman kalman;
+    kalman.setAngle(in.roll[0]);
+    benchmark_function("Kalman::getAngle", counters, output, [&](int i) {
+        output[i] = kalman.getAngle(in.roll[i], in.roll_rate[i], in.dt);
+    });
+    benchmark_function("Kalman::predict", counters, output, [&](int i) {
+        output[i] = kalman.predict(in.roll_rate[i], in.dt);
+    });
+    benchmark_function("Kalman::correct", counters, output, [&](int i) {
+        output[i] = kalman.correct(in.roll[i]);
+    });
+    std::vector<Kalman> restarted(16);
+    benchmark_function("Kalman::setAngle", counters, output, [&](int i) {
+        restarted[i & 15].setAngle(in.roll[i]);
+        output[i] = in.roll[i];
+    });
+    benchmark_function("distance", counters, output, [&](int i) {
+        output[i] = distance(in.accY[i], in.accZ[i]);
+    });
+    benchmark_function("atan2_deg", counters, output, [&](int i) {
+        output[i] = atan2_deg(in.accY[i], in.accZ[i]);
+    });
+    benchmark_function("atan_deg", counters, output, [&](int i) {
+        output[i] = atan_deg(-in.accX[i], in.accY[i], in.accZ[i]);
+    });
+    benchmark_function("fast_atan2_deg", counters, output, [&](int i) {
+        output[i] = fast_atan2_deg(in.accY[i], in.accZ[i]);
+    });
+    benchmark_function("fast_atan_deg", counters, output, [&](int i) {
+        output[i] = fast_atan_deg(-in.accX[i], in.accY[i], in.accZ[i]);
+    });
+    benchmark_function("max_drift_correction", counters, output, [&](int i) {
+        output[i] = max_drift_correction(in.roll_gyro[i], in.roll_fused[i]);
+    });
+    benchmark_function("max_90_deg_correction", counters, output, [&](int i) {
+        output[i] = max_90_deg_correction(in.roll_rate[i], in.roll_fused[i]);
+    });
+    return 0;
+}
+
+/* The outputs of the engine over the replay, every sample after the first as in benchmark_engine() */
+template <class Engine>
+void golden_replay(const Replay &replay, const char *label, Engine configured, GoldenOutput *output)
+{
+    double roll;
+    double pitch;
+    Engine engine = configured;
+    golden_start(output, label, GOLDEN_STRIDE);
+    engine.setAngle(replay.samples[0].roll, replay.samples[0].pitch);
+    for (size_t i = 1; i < replay.samples.size(); i++)
+    {
+        engine.getAngle(replay.samples[i], replay.dt[i], &roll, &pitch);
+        golden_add(output, roll, pitch);
+    }
+}
+
+int golden_record(const char *capture_path, const char *golden_path)
+{
+    Replay replay;
+    if (!load_replay(capture_path, &replay))
+    {
+        fprintf(stderr, "%s: cannot read capture\n", capture_path);
+        return 1;
+    }
+    std::vector<GoldenOutput> outputs;
+    for_all_engines([&](const char *label, auto configured) {
+        outputs.push_back(GoldenOutput());
+        golden_replay(replay, label, configured, &outputs.back());
+    });
+    if (!golden_save(golden_path, capture_path, outputs))
+    {
+        perror(golden_path);
+        return 1;
+    }
+    return 0;
+}
+
+int golden_check(const char *capture_path, const char *golden_path, double tolerance_degrees)
+{
+    Replay replay;
+    std::vector<GoldenOutput> golden;
+    if (!load_replay(capture_path, &replay))
+    {
+        fprintf(stderr, "%s: cannot read capture\n", capture_path);
+        return 1;
+    }
+    if (!golden_load(golden_path, &golden))
+    {
+        fprintf(stderr, "%s: cannot read golden outputs\n", golden_path);
+        return 1;
+    }
+
+    bool passed = true;
+    printf("# %s against %s, tolerance %g degrees\n", capture_path, golden_path, tolerance_degrees);
+    printf("%-20s %-8s %16s %10s\n", "engine", "status", "max_diff_deg", "ns/update");
+    for_all_engines([&](const char *label, auto configured) {
+        GoldenOutput output;
+        golden_replay(replay, label, configured, &output);
+        const GoldenOutput *expected = golden_find(golden, label);
+        double difference = expected ? golden_max_difference(*expected, output) : INFINITY;
+        const char *status = "FAIL";
+        if (expected && expected->hash == output.hash && difference == 0)
+            status = "exact";
+        else if (difference <= tolerance_degrees && tolerance_degrees > 0)
+            status = "within";
+        passed = passed && strcmp(status, "FAIL") != 0;
+        printf("%-20s %-8s %16.9g %10.1f\n", label, status, difference, time_engine(replay, configured, 1));
+    });
+    return passed ? 0 : 1;
+}
+
+double cpu_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* CPU time per sample in ns of the stage, the fastest of STAGE_REPEATS runs. The function
+   handles sample i, waited() tells the CPU time spent waiting on a simulated bus so far,
+   which is not counted */
+template <class Function, class Waited>
+double time_stage(size_t count, Function function, Waited waited)
+{
+    double fastest = INFINITY;
+    for (int repeat = 0; repeat < STAGE_REPEATS; repeat++)
+    {
+        long samples = 0;
+        double start = cpu_seconds();
+        double start_waited = waited();
+        double seconds;
+        do
+        {
+            for (size_t i = 0; i < count; i++)
+                function(i);
+            samples += count;
+            seconds = cpu_seconds() - start;
+        } while (seconds < MIN_BENCHMARK_SECONDS / STAGE_REPEATS);
+        fastest = fmin(fastest, (seconds - (waited() - start_waited)) * 1e9 / samples);
+    }
+    return fastest;
+}
+
+template <class Function>
+double time_stage(size_t count, Function function)
+{
+    return time_stage(count, function, []() { return 0.0; });
+}
+
+/* One round of the stages of the loop of the program on the tilt scenario, see PerfHistory.h */
+void measure_stage_round(double stage_ns[PERF_STAGE_COUNT])
+{
+    SensorModel model;
+    std::vector<CaptureRecord> records;
+    Replay replay;
+    sensor_model_default(&model);
+    motion_generate(MOTION_TILT, model, STAGE_SECONDS, &records);
+    replay_from_records(records, &replay);
+    size_t count = replay.samples.size();
+
+    /* read_sensor_data() of the program with the temperature, on the simulated bus of -P. A
+       transaction time would add clock reads per register that the waited time does not
+       cover, so by default the bus answers at once and the simulated sensor is timed along.
+       The device bus is never used once simulated */
+    SensorBusOn<SimulatedMpu6050> bus;
+    FullScaleRange range;
+    SensorReading reading;
+    bus.simulate(STAGE_TRANSACTION_US);
+    range_configure(bus, &range, 0, 0, false);
+    stage_ns[STAGE_I2C_READ] = time_stage(count, [&](size_t) {
+        sensor_read(bus, &range, 0, true, &reading);
+        benchmark_sink = reading.accX + reading.gyroX + reading.temp_raw;
+    }, [&]() { return bus.getWaitedSeconds(); });
+
+    /* With the polynomials, as the program defines FAST_ATAN */
+    stage_ns[STAGE_ANGLE_MATH] = time_stage(count, [&](size_t i) {
+        const ImuSample &sample = replay.samples[i];
+        benchmark_sink = fast_atan2_deg(sample.accY, sample.accZ) + fast_atan_deg(-sample.accX, sample.accY, sample.accZ);
+    });
+
+    KalmanEngine engine;
+    engine.setAngle(replay.samples[0].roll, replay.samples[0].pitch);
+    stage_ns[STAGE_GET_ANGLE] = time_stage(count, [&](size_t i) {
+        double roll, pitch;
+        engine.getAngle(replay.samples[i], replay.dt[i], &roll, &pitch);
+        benchmark_sink = roll + pitch;
+    });
+
+    /* The line print_columns() prints with all columns, into a buffer that is rewound per line */
+    char buffer[256];
+    FILE *file = fmemopen(buffer, sizeof(buffer), "w");
+    OutputColumns columns;
+    columns_start(&columns, COLUMN_ALL, replay.samples[0].roll, replay.samples[0].pitch);
+    stage_ns[STAGE_OUTPUT_FORMAT] = time_stage(count, [&](size_t i) {
+        const ImuSample &sample = replay.samples[i];
+        columns.roll                = sample.roll;
+        columns.roll_gyro           = sample.roll + 0.1;
+        columns.roll_complementary  = sample.roll - 0.1;
+        columns.roll_fused          = sample.roll + 0.2;
+        columns.pitch               = sample.pitch;
+        columns.pitch_gyro          = sample.pitch + 0.1;
+        columns.pitch_complementary = sample.pitch - 0.1;
+        columns.pitch_fused         = sample.pitch + 0.2;
+        rewind(file);
+        columns_print_line(file, columns, NULL, 24.8);
+        benchmark_sink = ftell(file);
+    });
+    fclose(file);
+}
+
+/* The fastest of STAGE_ROUNDS rounds per stage, so that a slow spell of the machine does not
+   reach the history as a regression */
+void measure_stages(double stage_ns[PERF_STAGE_COUNT])
+{
+    for (int stage = 0; stage < PERF_STAGE_COUNT; stage++)
+        stage_ns[stage] = INFINITY;
+    for (int round = 0; round < STAGE_ROUNDS; round++)
+    {
+        double round_ns[PERF_STAGE_COUNT];
+        measure_stage_round(round_ns);
+        for (int stage = 0; stage < PERF_STAGE_COUNT; stage++)
+            stage_ns[stage] = fmin(stage_ns[stage], round_ns[stage]);
+    }
+}
+
+void print_stages(const double stage_ns[PERF_STAGE_COUNT])
+{
+    printf("%-16s %10s\n", "stage", "ns/sample");
+    for (int stage = 0; stage < PERF_STAGE_COUNT; stage++)
+        printf("%-16s %10.1f\n", perf_stage_names[stage], stage_ns[stage]);
+}
+
+int benchmark_stages()
+{
+    double stage_ns[PERF_STAGE_COUNT];
+    measure_stages(stage_ns);
+    print_stages(stage_ns);
+    return 0;
+}
+
+int history_save(const char *path, const char *commit)
+{
+    std::vector<PerfRecord> records;
+    if (!perf_history_load(path, &records))
+    {
+        fprintf(stderr, "%s: broken history\n", path);
+        return 1;
+    }
+    PerfRecord record;
+    snprintf(record.commit, sizeof(record.commit), "%s", commit);
+    snprintf(record.compiler, sizeof(record.compiler), "%s", __VERSION__);
+    record.time = (long)time(NULL);
+    measure_stages(record.stage_ns);
+    records.push_back(record);
+    if (!perf_history_save(path, records))
+    {
+        perror(path);
+        return 1;
+    }
+    print_stages(record.stage_ns);
+    return 0;
+}
+
+/* The arguments are an optional baseline commit and stage=percent budgets */
+int history_compare(const char *path, int argc, char *argv[])
+{
+    std::vector<PerfRecord> records;
+    if (!perf_history_load(path, &records))
+    {
+        fprintf(stderr, "%s: broken history\n", path);
+        return 1;
+    }
+
+    double budget_percent[PERF_STAGE_COUNT];
+    const char *baseline_commit = NULL;
+    for (int stage = 0; stage < PERF_STAGE_COUNT; stage++)
+        budget_percent[stage] = PERF_BUDGET_PERCENT;
+    for (int a = 0; a < argc; a++)
+    {
+        char name[PERF_TEXT_LENGTH];
+        double percent;
+        if (sscanf(argv[a], "%63[^=]=%lf", name, &percent) == 2 && perf_stage_from_name(name) >= 0)
+            budget_percent[perf_stage_from_name(name)] = percent;
+        else if (!strchr(argv[a], '=') && !baseline_commit)
+            baseline_commit = argv[a];
+        else
+        {
+            fprintf(stderr, "%s: not a stage=percent budget\n", argv[a]);
+            return 1;
+        }
+    }
+
+    if (records.size() < 2)
+    {
+        fprintf(stderr, "%s: nothing to compare, save at least two records\n", path);
+        return 1;
+    }
+    const PerfRecord &latest = records.back();
+    const PerfRecord *baseline = &records[records.size() - 2];
+    if (baseline_commit)
+    {
+        baseline = NULL;
+        for (size_t i = 0; i + 1 < records.size(); i++)
+            if (strcmp(records[i].commit, baseline_commit) == 0)
+                baseline = &records[i];
+        if (!baseline)
+        {
+            fprintf(stderr, "%s: no record of %s\n", path, baseline_commit);
+            return 1;
+        }
+    }
+
+    bool regressed = false;
+    printf("# %s against %s\n", latest.commit, baseline->commit);
+    printf("%-16s %12s %12s %10s %10s %s\n", "stage", "baseline_ns", "latest_ns", "change_%", "budget_%", "status");
+    for (int stage = 0; stage < PERF_STAGE_COUNT; stage++)
+    {
+        double before = baseline->stage_ns[stage];
+        double after  = latest.stage_ns[stage];
+        bool over     = perf_over_budget(before, after, budget_percent[stage]);
+        regressed     = regressed || over;
+        printf("%-16s %12.1f %12.1f %10.1f %10.1f %s\n", perf_stage_names[stage], before, after,
+               before > 0 ? 100 * (after - before) / before : 0, budget_percent[stage], over ? "REGRESSION" : "ok");
+    }
+    return regressed ? 1 : 0;
+}
+
+/* Parses the sensor model options of synthetic and generate, returns false on a bad option */
+bool parse_sensor_model(int argc, char *argv[], SensorModel *model, double *seconds)
+{
+    int option;
+    sensor_model_default(model);
+    *seconds = SYNTHETIC_SECONDS;
+    optind = 1;
+    while ((option = getopt(argc, argv, "b:d:f:g:n:r:s:T:")) != -1)
+    {
+        bool valid = true;
+        switch (option)
+        {
+        case 'b':
+            valid = sscanf(optarg, "%lf:%lf:%lf", &model->gyro_bias_deg_per_sec[0], &model->gyro_bias_deg_per_sec[1],
+                           &model->gyro_bias_deg_per_sec[2]) == 3;
+            break;
+        case 'd':
+            model->gyro_drift_deg_per_sec_per_c = atof(optarg);
+            break;
+        case 'f':
+            model->rate_hz = atof(optarg);
+            valid = model->rate_hz > 0;
+            break;
+        case 'g':
+            model->gyro_range_deg_per_sec = atoi(optarg);
+            valid = full_scale_from_range(gyro_ranges_deg_per_sec, model->gyro_range_deg_per_sec) >= 0;
+            break;
+        case 'n':
+            valid = sscanf(optarg, "%lf:%lf", &model->gyro_noise_deg_per_sec, &model->accel_noise_g) == 2;
+            break;
+        case 'r':
+            model->accel_range_g = atoi(optarg);
+            valid = full_scale_from_range(accel_ranges_g, model->accel_range_g) >= 0;
+            break;
+        case 's':
+            *seconds = atof(optarg);
+            valid = *seconds > 0;
+            break;
+        case 'T':
+            valid = sscanf(optarg, "%lf:%lf", &model->temp_start_c, &model->temp_end_c) == 2;
+            break;
+        default:
+            valid = false;
+            break;
+        }
+        if (!valid)
+            return false;
+    }
+    return optind == argc;
+}
+
+int benchmark_synthetic(const SensorModel &model, double seconds)
+{
+    printf("# %.0f s at %.0f Hz, gyro bias %.2f %.2f %.2f deg/s, drift %.3f deg/s/C over %.0f to %.0f C\n", seconds,
+           model.rate_hz, model.gyro_bias_deg_per_sec[0], model.gyro_bias_deg_per_sec[1], model.gyro_bias_deg_per_sec[2],
+           model.gyro_drift_deg_per_sec_per_c, model.temp_start_c, model.temp_end_c);
+    printf("# noise %.3f deg/s %.4f g, ranges %d deg/s %d g\n", model.gyro_noise_deg_per_sec, model.accel_noise_g,
+           model.gyro_range_deg_per_sec, model.accel_range_g);
+    for (int scenario = 0; scenario < MOTION_SCENARIO_COUNT; scenario++)
+    {
+        std::vector<CaptureRecord> records;
+        Replay replay;
+        motion_generate((MotionScenario)scenario, model, seconds, &records);
+        replay_from_records(records, &replay);
+        printf("# scenario %s: %zu samples, error against true angles\n", motion_scenario_names[scenario], records.size());
+        benchmark_all_engines(replay);
+    }
+    return 0;
+}
+
+int generate_capture(MotionScenario scenario, const char *path, const SensorModel &model, double seconds)
+{
+    std::vector<CaptureRecord> records;
+    motion_generate(scenario, model, seconds, &records);
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        perror(path);
+        return 1;
+    }
+    capture_write_header(file);
+    for (size_t i = 0; i < records.size(); i++)
+        capture_write(file, records[i]);
+    fclose(file);
+    return 0;
+}
+
+void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s engines capture.txt [capture.txt ...]\n", program);
+    fprintf(stderr, "       %s startup capture.txt\n", program);
+    fprintf(stderr, "       %s atan\n", program);
+    fprintf(stderr, "       %s functions\n", program);
+    fprintf(stderr, "       %s synthetic [-s seconds] [-f rate_hz] [-b x:y:z] [-d drift] [-T start:end] [-n gyro:accel] [-g range] [-r range]\n", program);
+    fprintf(stderr, "       %s generate static|tilt|vibration|impacts|spin|inverted capture.txt [the options of synthetic]\n", program);
+    fprintf(stderr, "       %s golden record capture.txt golden.txt\n", program);
+    fprintf(stderr, "       %s golden check [capture.txt golden.txt [tolerance_degrees]]\n", program);
+    fprintf(stderr, "       %s stages\n", program);
+    fprintf(stderr, "       %s tempmodel\n", program);
+    fprintf(stderr, "       %s history save history.json commit\n", program);
+    fprintf(stderr, "       %s history compare history.json [baseline_commit] [stage=percent ...]\n", program);
+    fprintf(stderr, "       %s columns capture.txt\n", program);
+    fprintf(stderr, "       %s multirate capture.txt\n", program);
+    fprintf(stderr, "       %s integration capture.txt\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && strcmp(argv[1], "engines") == 0)
+        return benchmark_engines(argc - 2, argv + 2);
+    if (argc == 3 && strcmp(argv[1], "startup") == 0)
+        return benchmark_startup(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "columns") == 0)
+        return benchmark_columns(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "multirate") == 0)
+        return benchmark_multirate(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "integration") == 0)
+        return benchmark_integration(argv[2]);
+    if (argc == 2 && strcmp(argv[1], "atan") == 0)
+        return benchmark_atan();
+    if (argc == 2 && strcmp(argv[1], "functions") == 0)
+        return benchmark_functions();
+    if (argc == 2 && strcmp(argv[1], "tempmodel") == 0)
+        return benchmark_tempmodel();
+    if (argc == 2 && strcmp(argv[1], "stages") == 0)
+        return benchmark_stages();
+    if (argc == 5 && strcmp(argv[1], "history") == 0 && strcmp(argv[2], "save") == 0)
+        return history_save(argv[3], argv[4]);
+    if (argc >= 4 && strcmp(argv[1], "history") == 0 && strcmp(argv[2], "compare") == 0)
+        return history_compare(argv[3], argc - 4, argv + 4);
+    if (argc == 5 && strcmp(argv[1], "golden") == 0 && strcmp(argv[2], "record") == 0)
+        return golden_record(argv[3], argv[4]);
+    if ((argc == 5 || argc == 6) && strcmp(argv[1], "golden") == 0 && strcmp(argv[2], "check") == 0)
+        return golden_check(argv[3], argv[4], argc == 6 ? atof(argv[5]) : 0);
+    if (argc == 3 && strcmp(argv[1], "golden") == 0 && strcmp(argv[2], "check") == 0)
+        return golden_check(GOLDEN_CAPTURE_PATH, GOLDEN_PATH, GOLDEN_TOLERANCE_DEGREES);
+
+    SensorModel model;
+    double seconds;
+    if (argc >= 2 && strcmp(argv[1], "synthetic") == 0 && parse_sensor_model(argc - 1, argv + 1, &model, &seconds))
+        return benchmark_synthetic(model, seconds);
+    if (argc >= 4 && strcmp(argv[1], "generate") == 0 && motion_scenario_from_name(argv[2]) != MOTION_SCENARIO_COUNT
+        && parse_sensor_model(argc - 3, argv + 3, &model, &seconds))
+        return generate_capture(motion_scenario_from_name(argv[2]), argv[3], model, seconds);
+
+    print_usage(argv[0]);
+    return 1;
+}
@@ -36,35 +36,53 @@
  https://github.com/TKJElectronics/KalmanFilter
  */
 
-#include "Kalman.h" /* Source: https://github.com/TKJElectronics/KalmanFilter */
-#include <wiringPiI2C.h>
 #include <wiringPi.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
+#include <unistd.h>
+#include <signal.h>
 
-/* MPU6050 */
-#define MPU6050_I2C_DEVICE_ADDRESS     0x68
-#define REGISTER_FOR_POWER_MANAGEMENT  0x6B  /* PWR_MGMT_1 */
-#define REGISTER_FOR_SAMPLE_RATE       0x19  /* SMPLRT_DIV */
-#define REGISTER_FOR_ACCEL_XOUT_H      0x3B
-#define REGISTER_FOR_ACCEL_YOUT_H      0x3D
-#define REGISTER_FOR_ACCEL_ZOUT_H      0x3F
-#define REGISTER_FOR_GYRO_XOUT_H       0x43
-#define REGISTER_FOR_GYRO_YOUT_H       0x45
-#define REGISTER_FOR_GYRO_ZOUT_H       0x47
-#define REGISTER_FOR_TEMP_OUT_H        0x41
-#define SLEEP_MODE_DISABLED            0x00
-
-/* Different math and print constants */
-#define RAD_TO_DEG                     (180.0 / M_PI)
-#define DRIFT_MAX_DEGREES              180
+/* To restrict roll instead of pitch to ±90 degrees by default, comment out the following line (or use -x roll) */
+#define PITCH_RESTRICT_90_DEG
+
+/* To compute the accelerometer angles with libm instead of the polynomials of FastAtan.h, comment out the following line */
+#define FAST_ATAN
+
+#include "FusionEngine.h" /* Kalman.h source: https://github.com/TKJElectronics/KalmanFilter */
+#include "WiringPiBus.h"
+#include "SensorBus.h"
+#include "SensorRead.h"
+#include "Capture.h"
+#include "FilterState.h"
+#include "GyroCalibration.h"
+#include "GyroTempModel.h"
+#include "OffsetCalibration.h"
+#include "FullScaleRange.h"
+#include "SampleRate.h"
+#include "OutputColumns.h"
+#include "PipelineStats.h"
+#include "EventLoop.h"
+#include "ControlSocket.h"
+#include "Pipeline.h"
+
+/* Different print constants */
 #define LABEL_REPEAT_RATE              30
 
-/* To restrict roll instead of pitch to ±90 degrees, comment out the following line */
-#define PITCH_RESTRICT_90_DEG
+/* Startup and shutdown */
+#define SENSOR_READY_TIMEOUT_MS        150
+#define STATE_SAVE_INTERVAL_SECONDS    60
+#define TEMP_MODEL_CALIBRATION_WEIGHT  100   /* A still calibration counts as this many observations */
+
+/* Event loop */
+#define SAMPLE_WAKE_MARGIN             0.2   /* At a rate, wake up this part of a period before the next sample */
+
+/* Pipeline benchmark */
+#define PIPELINE_SECONDS_PER_RUN       2.0   /* Per engine and output sink */
 
-/* MPU6050 variables */
-int gyro_device_handler;
+/* MPU6050 variables, the accelerometer and gyro in LSB of the default full-scale ranges */
+SensorBusOn<WiringPiBus> gyro_device;
+FullScaleRange full_scale_range;
 double accX;
 double accY;
 double accZ;
@@ -73,205 +91,962 @@ double gyroY;
 double gyroZ;
 double temp_raw;
 
+/* Startup options */
+FusionEngineId fusion_engine = FUSION_KALMAN;
+AngleConvention angle_convention = DEFAULT_ANGLE_CONVENTION;
+bool both_conventions = false; /* Also print the angles in the other convention, from the same samples */
+FILE *capture_file = NULL;  /* Raw samples are recorded here when set */
+bool kalman_adaptive = false; /* Adaptive measurement noise, see Kalman::setAdaptive */
+bool kalman_tuned = false;  /* Use the tuning below instead of the defaults in Kalman.h */
+double kalman_Q_angle;
+double kalman_Q_bias;
+double kalman_R_measure;
+int kalman_correction_interval = 1; /* The accelerometer corrects the Kalman filter at one in this many samples */
+bool calibrate_gyro = true;   /* Measure the gyro offsets at startup when the sensor is still */
+const char *state_path = NULL; /* Converged filter state is saved here and restored at startup when set */
+const char *offsets_path = NULL; /* Offset register values written to the sensor at startup when set */
+const char *temp_model_path = NULL; /* The gyro bias versus temperature model is learned and kept here when set */
+int gyro_full_scale = 0;      /* FS_SEL, ±250 degrees per second */
+int accel_full_scale = 0;     /* AFS_SEL, ±2 g */
+bool auto_range = false;      /* Step the full-scale ranges up on saturation and down when quiet */
+double fusion_rate_hz = 0;    /* When set, the sensor is configured for this rate and the loop runs at its pace */
+SampleRateConfig sample_rate;
+int output_decimation = 1;    /* Print one in this many samples */
+int selected_columns = COLUMN_ALL;
+RateIntegration rate_integration = INTEGRATE_EULER; /* Of the gyro rates, in the gyro and complementary columns and the Kalman filter */
+double pipeline_transaction_us = -1; /* When set, benchmark the loop on the simulated sensor with this time per register */
+
+double stats_interval_seconds = 0; /* When set, the sample rate is printed on stderr this often */
+const char *control_path = NULL; /* Commands are taken on a Unix socket here when set, see ControlSocket.h */
+
+bool running = true;          /* Until a signal stops the program */
+
+/* Gyro offsets in degrees per second: the temperature model, plus what the startup calibration found on top of it */
+GyroCalibration gyro_calibration;
+GyroTempModel temp_model;
+double gyro_offset[3];
+
 /* Variables used for printing */
 int counter = 0;
 double temp_degrees_c;
-double roll_gyro;
-double roll;
-double roll_kalman;         /* Angle exposed to a Kalman filter */
-double roll_complementary;  /* Angle exposed to a Complementary filter */
-double pitch;
-double pitch_gyro;
-double pitch_kalman;        /* Angle exposed to a Kalman filter */
-double pitch_complementary; /* Angle exposed to a Complementary filter */
-
-int read_word_2c(int register_h)
-{
-    int val;
-    val = wiringPiI2CReadReg8(gyro_device_handler, register_h);
-    val = val << 8;
-    val += wiringPiI2CReadReg8(gyro_device_handler, register_h+1);
-    if (val >= 0x8000)
-        val = -(65536 - val);
-    return val;
-}
+OutputColumns columns;
+OutputColumns columns_second; /* In the other convention, with both_conventions */
+bool read_temperature = true; /* TEMP_OUT is only read when a column or a file needs it */
+bool print_output = true;     /* The pipeline benchmark also runs without printing */
+PipelineStats pipeline_stats;
+ControlSocket control;
+
+/* Parameters of the control socket, with get and set */
+enum ControlParameter {
+    PARAMETER_ENGINE,
+    PARAMETER_Q_ANGLE,
+    PARAMETER_Q_BIAS,
+    PARAMETER_R_MEASURE,
+    PARAMETER_COMPLEMENTARY,
+    PARAMETER_COLUMNS,
+    PARAMETER_DECIMATION,
+    CONTROL_PARAMETER_COUNT
+};
+
+const char *control_parameters[CONTROL_PARAMETER_COUNT] = { "engine", "q_angle", "q_bias", "r_measure", "complementary", "columns", "decimation" };
 
 void read_sensor_data()
 {
-    accX     = read_word_2c(REGISTER_FOR_ACCEL_XOUT_H);
-    accY     = read_word_2c(REGISTER_FOR_ACCEL_YOUT_H);
-    accZ     = read_word_2c(REGISTER_FOR_ACCEL_ZOUT_H);
-    gyroX    = read_word_2c(REGISTER_FOR_GYRO_XOUT_H);
-    gyroY    = read_word_2c(REGISTER_FOR_GYRO_YOUT_H);
-    gyroZ    = read_word_2c(REGISTER_FOR_GYRO_ZOUT_H);
-    temp_raw = read_word_2c(REGISTER_FOR_TEMP_OUT_H);
+    SensorReading reading;
+    reading.temp_raw = temp_raw;
+    sensor_read(gyro_device, &full_scale_range, fusion_rate_hz > 0 ? sample_rate.dt : 0, read_temperature, &reading);
+    accX     = reading.accX;
+    accY     = reading.accY;
+    accZ     = reading.accZ;
+    gyroX    = reading.gyroX;
+    gyroY    = reading.gyroY;
+    gyroZ    = reading.gyroZ;
+    temp_raw = reading.temp_raw;
 }
 
-double convert_to_deg_per_sec(double a)
+/* Polls the data ready flag of the sensor instead of waiting a fixed time after wake-up */
+bool wait_for_sensor_ready()
 {
-    return a / 131.0;
+    unsigned int start = millis();
+    gyro_device.writeReg8(REGISTER_FOR_INT_ENABLE, DATA_READY);
+    while (millis() - start < SENSOR_READY_TIMEOUT_MS)
+    {
+        if (gyro_device.readReg8(REGISTER_FOR_INT_STATUS) & DATA_READY)
+            return true;
+        delay(1);
+    }
+    return false;
 }
 
-double distance(double a, double b)
+void record_sensor_data(unsigned int start_micros)
 {
-    return sqrt((a*a) + (b*b));
+    CaptureRecord record;
+    record.t_us      = (double)(micros() - start_micros);
+    record.accX      = (int)accX;
+    record.accY      = (int)accY;
+    record.accZ      = (int)accZ;
+    record.gyroX     = (int)gyroX;
+    record.gyroY     = (int)gyroY;
+    record.gyroZ     = (int)gyroZ;
+    record.temp_raw  = (int)temp_raw;
+    record.has_truth = false;
+    capture_write(capture_file, record);
 }
 
-double atan2_deg(double a, double b)
+/* Prints the selected columns, roll first and then pitch, as they have always been laid out.
+   With both_conventions the columns of the other convention follow, labeled with the range
+   of each axis */
+void print_columns()
 {
-    return atan2(a,b) * RAD_TO_DEG;
+    const char *axes[2] = { "roll", "pitch" };
+    const char *axes_second[2][2] = { { "roll180", "pitch90" }, { "roll90", "pitch180" } };
+
+    if (counter % LABEL_REPEAT_RATE == 0)
+    {
+        columns_print_labels(stdout, columns, axes, fusion_engine_names[fusion_engine]);
+        if (both_conventions)
+            columns_print_labels(stdout, columns_second, axes_second[OTHER_CONVENTION(angle_convention)], fusion_engine_names[fusion_engine]);
+        if (columns.selected & COLUMN_TEMP)
+            printf("temp/*C ");
+        printf("\r\n");
+    }
+
+    columns_print_line(stdout, columns, both_conventions ? &columns_second : NULL, temp_degrees_c);
+    if (fusion_rate_hz <= 0 && !gyro_device.isSimulated())
+        delay(5);
 }
 
-double atan_deg(double a, double b, double c)
+/* Rate of a gyro axis with the bias from the temperature model removed */
+double temp_compensated_rate(int axis, double gyro)
 {
-    return atan(a / distance(b, c)) * RAD_TO_DEG;
+    return convert_to_deg_per_sec(gyro) - temp_model_bias(&temp_model, axis, temp_degrees_c);
 }
 
-double max_drift_correction(double gyro, double kalman)
+/* The engines get the temperature compensated rates, the startup offsets are given to them
+   with setGyroBias(). The accelerometer angles are filled in by columns_update() */
+ImuSample make_sample()
 {
-    if (gyro < -DRIFT_MAX_DEGREES || gyro > DRIFT_MAX_DEGREES)
-        return kalman;
-    else
-        return gyro;
+    ImuSample sample;
+    sample.accX       = accX;
+    sample.accY       = accY;
+    sample.accZ       = accZ;
+    sample.roll_rate  = temp_compensated_rate(0, gyroX);
+    sample.pitch_rate = temp_compensated_rate(1, gyroY);
+    sample.yaw_rate   = temp_compensated_rate(2, gyroZ);
+    return sample;
 }
 
-double max_90_deg_correction(double rate, double kalman)
+/* Only the Kalman engine has the Q_angle, Q_bias and R_measure tuning */
+template <class Engine>
+void apply_tuning(Engine &)
 {
-    if (abs(kalman) > 90)
-        return -rate;
-    else
-        return rate;
 }
 
-void print_columns()
+/* Without an explicit tuning, the measurement noise of the defaults follows the accelerometer bandwidth */
+template <AngleConvention convention>
+void apply_tuning(KalmanEngineIn<convention> &engine)
 {
-    if (counter % LABEL_REPEAT_RATE == 0)
-        printf("roll \t roll_gyro \t roll_complementary \t roll_kalman \t \t \t pitch \t pitch_gyro \t pitch_complementary \t pitch_kalman \t \t \t temp/*C \r\n");
+    engine.setAdaptive(kalman_adaptive);
+    engine.setCorrectionInterval(kalman_correction_interval);
+    engine.setIntegration(rate_integration);
+    if (kalman_tuned)
+        engine.setTuning(kalman_Q_angle, kalman_Q_bias, kalman_R_measure);
+    else if (fusion_rate_hz > 0)
+    {
+        Kalman &kalman = engine.kalman_roll;
+        engine.setTuning(kalman.getQangle(), kalman.getQbias(), kalman.getRmeasure() * sample_rate_noise_scale(sample_rate));
+    }
+}
+
+/* Reads a short window of samples, and measures the gyro offsets if the sensor was still meanwhile */
+void run_gyro_calibration()
+{
+    gyro_calibration_reset(&gyro_calibration);
+    int samples = gyro_calibration_samples(fusion_rate_hz > 0 ? sample_rate.output_rate_hz : 0);
+    for (int i = 0; i < samples; i++)
+    {
+        read_sensor_data();
+        gyro_calibration_add(&gyro_calibration, gyroX, gyroY, gyroZ, accX, accY, accZ);
+    }
+    if (!gyro_calibration_finish(&gyro_calibration))
+    {
+        fprintf(stderr, "Sensor moved during the gyro calibration, skipped\n");
+        return;
+    }
+    fprintf(stderr, "Gyro offsets %.2f %.2f %.2f deg/s\n",
+            gyro_calibration.offset[0], gyro_calibration.offset[1], gyro_calibration.offset[2]);
+
+    /* A still calibration is also a good observation for the temperature model */
+    temp_degrees_c = convert_to_degrees_c(temp_raw);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (temp_model_path)
+            temp_model_add(&temp_model, axis, temp_degrees_c, gyro_calibration.offset[axis], TEMP_MODEL_CALIBRATION_WEIGHT);
+        gyro_offset[axis] = gyro_calibration.offset[axis] - temp_model_bias(&temp_model, axis, temp_degrees_c);
+    }
+}
 
-    printf("%.1f", roll); printf("\t\t");
-    printf("%.1f", roll_gyro); printf("\t\t\t");
-    printf("%.1f", roll_complementary); printf("\t\t");
-    printf("%.1f", roll_kalman); printf("\t");
+/* Only the Kalman engine estimates a bias, which is what the temperature model did not explain */
+template <class Engine>
+void learn_temp_model(Engine &)
+{
+}
 
-    printf("\t\t");
-    printf("%.1f", pitch); printf("\t\t");
-    printf("%.1f", pitch_gyro); printf("\t\t\t");
-    printf("%.1f", pitch_complementary); printf("\t\t");
-    printf("%.1f", pitch_kalman); printf("\t");
+template <AngleConvention convention>
+void learn_temp_model(KalmanEngineIn<convention> &engine)
+{
+    temp_model_learn(&temp_model, temp_degrees_c, engine);
+}
 
-    printf("\t\t");
-    printf("%.1f", temp_degrees_c); printf("\t");
+void save_temp_model()
+{
+    if (temp_model_path && !temp_model_save(temp_model_path, MPU6050_DEVICE_NAME, &temp_model))
+        perror(temp_model_path);
+}
 
-    printf("\r\n");
-    delay(5);
+/* Only the Kalman engine has a state worth saving: the converged gyro bias and error covariance */
+template <class Engine>
+void restore_state(Engine &)
+{
 }
 
-int main()
+template <class Engine>
+void save_state(Engine &)
+{
+}
+
+template <AngleConvention convention>
+void restore_state(KalmanEngineIn<convention> &engine)
+{
+    FilterStateEntry entry;
+    if (state_path && state_load(state_path, MPU6050_DEVICE_NAME, temp_degrees_c, &entry))
+        kalman_engine_set_state(engine, entry);
+}
+
+template <AngleConvention convention>
+void save_state(KalmanEngineIn<convention> &engine)
+{
+    FilterStateEntry entry;
+    if (!state_path)
+        return;
+    snprintf(entry.device, sizeof(entry.device), "%s", MPU6050_DEVICE_NAME);
+    entry.temp_bucket = state_temp_bucket(temp_degrees_c);
+    kalman_engine_get_state(engine, &entry);
+    if (!state_save(state_path, entry))
+        perror(state_path);
+}
+
+/* The acquire, fuse and print loop of one fusion engine, and what it keeps between samples */
+template <class Engine>
+struct FusionLoop {
+    typedef typename SecondConvention<Engine>::type SecondEngine;
+
+    EventLoop    events;
+    Engine       engine;
+    SecondEngine second_engine;  /* The other convention, only run with both_conventions */
+    int          timer;
+    unsigned int start_micros;
+    long         sample_count;
+    double       sample_ready;   /* When the last sample was read, for the sample trigger at a rate */
+    double       stats_start;
+    long         stats_samples;
+    double       stats_longest;  /* Longest time between two samples since the last stats, in seconds */
+};
+
+/* Reads, fuses and prints one sample */
+template <class Engine>
+void fusion_sample(FusionLoop<Engine> *loop)
 {
-    int timer;
     double seconds_passed;
-    double roll_gyro_rate_deg_per_sec;
-    double pitch_gyro_rate_deg_per_sec;
+    bool output = loop->sample_count++ % output_decimation == 0 && print_output;
+    read_sensor_data();
+    if (fusion_rate_hz > 0)
+        loop->sample_ready = EventLoop::now();
+    if (capture_file)
+        record_sensor_data(loop->start_micros);
+
+    temp_degrees_c              = convert_to_degrees_c(temp_raw);
+    seconds_passed              = (double)(micros() - loop->timer) / 1000000;
+    if (fusion_rate_hz > 0)
+        seconds_passed          = sample_rate_dt(sample_rate, seconds_passed);
+    loop->timer                 = micros();
+
+    double roll_rate            = temp_compensated_rate(0, gyroX) - gyro_offset[0];
+    double pitch_rate           = temp_compensated_rate(1, gyroY) - gyro_offset[1];
+    if (both_conventions)
+        columns_update_both(&columns, loop->engine, &columns_second, loop->second_engine, make_sample(),
+                            roll_rate, pitch_rate, seconds_passed, output);
+    else
+        columns_update(&columns, loop->engine, make_sample(), roll_rate, pitch_rate, seconds_passed, output);
+
+    if (output)
+    {
+        print_columns();
+        counter++;
+    }
+
+    if (temp_model_path && loop->sample_count % TEMP_MODEL_UPDATE_SAMPLES == 0)
+        learn_temp_model(loop->engine);
+
+    loop->stats_samples++;
+    if (seconds_passed > loop->stats_longest)
+        loop->stats_longest = seconds_passed;
+}
+
+/* fusion_sample(), timed by the pipeline benchmark as run_compiled() times its step, which
+   stops the loop when the run is over. The choice is compiled into the sample triggers */
+template <class Engine, bool timed>
+void trigger_sample(FusionLoop<Engine> *loop)
+{
+    if (!timed)
+    {
+        fusion_sample(loop);
+        return;
+    }
+    double sample_start = pipeline_now();
+    fusion_sample(loop);
+    if (!pipeline_stats_add(&pipeline_stats, sample_start))
+        loop->events.stop();
+}
+
+/* Sample trigger of a sensor that is read as fast as it answers, between the checks of the loop */
+template <class Engine, bool timed>
+void on_idle_sample(void *context)
+{
+    trigger_sample<Engine, timed>((FusionLoop<Engine> *)context);
+}
+
+/* Sample trigger of a sensor at a rate: the loop sleeps until shortly before the next sample is
+   due, and read_sensor_data() waits for the rest */
+template <class Engine, bool timed>
+void on_sample_timer(void *context)
+{
+    FusionLoop<Engine> *loop = (FusionLoop<Engine> *)context;
+    trigger_sample<Engine, timed>(loop);
+    loop->events.addTimer(loop->sample_ready + sample_rate.dt * (1 - SAMPLE_WAKE_MARGIN), on_sample_timer<Engine, timed>, loop);
+}
+
+template <class Engine>
+void on_save_timer(void *context)
+{
+    FusionLoop<Engine> *loop = (FusionLoop<Engine> *)context;
+    save_state(loop->engine);
+    save_temp_model();
+    loop->events.addTimer(EventLoop::now() + STATE_SAVE_INTERVAL_SECONDS, on_save_timer<Engine>, loop);
+}
+
+/* The stats since the last ones, which start again */
+template <class Engine>
+void take_stats(FusionLoop<Engine> *loop, char *text, size_t size)
+{
+    double now = EventLoop::now();
+    snprintf(text, size, "%ld samples in %.1f s, %.1f Hz, longest period %.2f ms", loop->stats_samples,
+             now - loop->stats_start, loop->stats_samples / (now - loop->stats_start), loop->stats_longest * 1000);
+    loop->stats_start   = now;
+    loop->stats_samples = 0;
+    loop->stats_longest = 0;
+}
+
+template <class Engine>
+void on_stats_timer(void *context)
+{
+    FusionLoop<Engine> *loop = (FusionLoop<Engine> *)context;
+    char text[128];
+    take_stats(loop, text, sizeof(text));
+    fprintf(stderr, "# %s\n", text);
+    loop->events.addTimer(EventLoop::now() + stats_interval_seconds, on_stats_timer<Engine>, loop);
+}
+
+/* The Kalman tuning of the engine, false for the other engines */
+template <class Engine>
+bool get_kalman_tuning(Engine &, double *, double *, double *)
+{
+    return false;
+}
+
+template <AngleConvention convention>
+bool get_kalman_tuning(KalmanEngineIn<convention> &engine, double *Q_angle, double *Q_bias, double *R_measure)
+{
+    *Q_angle   = engine.kalman_roll.getQangle();
+    *Q_bias    = engine.kalman_roll.getQbias();
+    *R_measure = engine.kalman_roll.getRmeasure();
+    return true;
+}
+
+/* The complementary engine follows the weight of the complementary column */
+template <class Engine>
+void set_complementary(Engine &, double)
+{
+}
 
-    Kalman kalman_roll;
-    Kalman kalman_pitch;
+template <AngleConvention convention>
+void set_complementary(ComplementaryEngineIn<convention> &engine, double gyro_weight)
+{
+    engine.setCoefficient(gyro_weight);
+}
 
-    gyro_device_handler = wiringPiI2CSetup(MPU6050_I2C_DEVICE_ADDRESS);
-    wiringPiI2CWriteReg8(gyro_device_handler,REGISTER_FOR_POWER_MANAGEMENT,SLEEP_MODE_DISABLED);
+/* Writes the value of a parameter of the control socket, false when the engine has no such parameter */
+template <class Engine>
+bool control_get(FusionLoop<Engine> *loop, ControlParameter parameter, char *text, size_t size)
+{
+    double tuning[3];
+    switch (parameter)
+    {
+    case PARAMETER_ENGINE:
+        snprintf(text, size, "%s", fusion_engine_names[Engine::id]);
+        return true;
+    case PARAMETER_Q_ANGLE:
+    case PARAMETER_Q_BIAS:
+    case PARAMETER_R_MEASURE:
+        if (!get_kalman_tuning(loop->engine, &tuning[0], &tuning[1], &tuning[2]))
+            return false;
+        snprintf(text, size, "%g", tuning[parameter - PARAMETER_Q_ANGLE]);
+        return true;
+    case PARAMETER_COMPLEMENTARY:
+        snprintf(text, size, "%g", columns.complementary_gyro);
+        return true;
+    case PARAMETER_COLUMNS:
+        columns_to_list(columns.selected, text, size);
+        return true;
+    default:
+        snprintf(text, size, "%d", output_decimation);
+        return true;
+    }
+}
 
-    /* Wait for sensor to stabilize */
-    delay(150);
+/* Changes a parameter of the control socket, returns an error message or NULL */
+template <class Engine>
+const char *control_set(FusionLoop<Engine> *loop, ControlParameter parameter, const char *value)
+{
+    char *end;
+    double number = strtod(value, &end);
+    bool is_number = end != value && *end == 0;
+    double tuning[3];
+    switch (parameter)
+    {
+    case PARAMETER_ENGINE:
+        return "the engine is chosen at startup";
+    case PARAMETER_Q_ANGLE:
+    case PARAMETER_Q_BIAS:
+    case PARAMETER_R_MEASURE:
+        if (!get_kalman_tuning(loop->engine, &tuning[0], &tuning[1], &tuning[2]))
+            return "only the kalman engine has this parameter";
+        if (!is_number || number < 0 || (parameter == PARAMETER_R_MEASURE && number == 0))
+            return "not a valid value";
+        tuning[parameter - PARAMETER_Q_ANGLE] = number;
+        kalman_Q_angle   = tuning[0];
+        kalman_Q_bias    = tuning[1];
+        kalman_R_measure = tuning[2];
+        kalman_tuned     = true;
+        apply_tuning(loop->engine);
+        apply_tuning(loop->second_engine);
+        return NULL;
+    case PARAMETER_COMPLEMENTARY:
+        if (!is_number || number < 0 || number >= 1)
+            return "the gyro weight must be from 0 to below 1";
+        columns_set_complementary(&columns, number);
+        columns_set_complementary(&columns_second, number);
+        set_complementary(loop->engine, number);
+        set_complementary(loop->second_engine, number);
+        return NULL;
+    case PARAMETER_COLUMNS:
+        if (!columns_from_list(value))
+            return "unknown column";
+        selected_columns = columns_from_list(value);
+        columns_select(&columns, loop->engine, selected_columns);
+        if (both_conventions)
+            columns_select(&columns_second, loop->second_engine, selected_columns);
+        read_temperature = (selected_columns & COLUMN_TEMP) || temp_model_path || state_path || capture_file;
+        counter          = 0; // Print the labels of the new columns first
+        return NULL;
+    default:
+        if (!is_number || number < 1 || number != (int)number)
+            return "not a whole number of 1 or more";
+        output_decimation = (int)number;
+        return NULL;
+    }
+}
+
+/* Handles a command of the control socket. It runs between two samples, so a change applies
+   to the next sample as a whole */
+template <class Engine>
+void on_control_command(void *context, const char *line, std::string *reply)
+{
+    FusionLoop<Engine> *loop = (FusionLoop<Engine> *)context;
+    char command[16];
+    char name[32];
+    char value[128];
+    char text[160];
+    int words = sscanf(line, "%15s %31s %127s", command, name, value);
+    int parameter = 0;
+    while (words >= 2 && parameter < CONTROL_PARAMETER_COUNT && strcmp(name, control_parameters[parameter]) != 0)
+        parameter++;
+
+    if (words < 1)
+        return;
+    if (strcmp(command, "get") == 0 && words == 1)
+    {
+        for (parameter = 0; parameter < CONTROL_PARAMETER_COUNT; parameter++)
+            if (control_get(loop, (ControlParameter)parameter, text, sizeof(text)))
+                *reply += std::string(control_parameters[parameter]) + " " + text + "\n";
+    }
+    else if (strcmp(command, "get") == 0 && words == 2 && parameter < CONTROL_PARAMETER_COUNT)
+    {
+        if (control_get(loop, (ControlParameter)parameter, text, sizeof(text)))
+            *reply += std::string(text) + "\n";
+        else
+            *reply += "error: only the kalman engine has this parameter\n";
+    }
+    else if (strcmp(command, "set") == 0 && words == 3 && parameter < CONTROL_PARAMETER_COUNT)
+    {
+        const char *error = control_set(loop, (ControlParameter)parameter, value);
+        *reply += error ? std::string("error: ") + error + "\n" : std::string("ok\n");
+    }
+    else if (strcmp(command, "stats") == 0 && words == 1)
+    {
+        take_stats(loop, text, sizeof(text));
+        *reply += std::string(text) + "\n";
+    }
+    else if (strcmp(command, "help") == 0)
+    {
+        *reply += "get [name]          all parameters, or one\n";
+        *reply += "set name value      q_angle, q_bias, r_measure, complementary, columns (as -c), decimation (as -d)\n";
+        *reply += "stats               samples and rate since the last stats\n";
+    }
+    else
+        *reply += "error: unknown command or parameter, see help\n";
+}
+
+/* Stops on Ctrl-C and kill between two samples, so the output, the state and the capture are complete */
+void on_signal(void *context, int)
+{
+    running = false;
+    ((EventLoop *)context)->stop();
+}
+
+/* Runs the loop, compiled once per fusion engine, until a signal stops it */
+template <class Engine>
+void run_fusion()
+{
+    FusionLoop<Engine> loop;
+    double roll;
+    double pitch;
+    sigset_t signals;
+
+    apply_tuning(loop.engine);
 
     /* Set the gyro starting angles */
     read_sensor_data();
-
-#ifdef PITCH_RESTRICT_90_DEG
-    roll  = atan2_deg(accY, accZ);
-    pitch = atan_deg(-accX, accY, accZ);
-#else
-    roll  = atan_deg(accY, accX, accZ);
-    pitch = atan2_deg(-accX, accZ);
-#endif
+    temp_degrees_c = convert_to_degrees_c(temp_raw);
+    accel_angles(Engine::convention, accX, accY, accZ, &roll, &pitch);
 
     /* Set some more initial values */
-    kalman_roll.setAngle(roll);
-    roll_gyro           = roll;
-    roll_complementary  = roll;  /* Angle exposed to a complementary filter */
-    kalman_pitch.setAngle(pitch);
-    pitch_gyro          = pitch;
-    pitch_complementary = pitch; /* Angle exposed to a complementary filter */
-    timer               = micros();
-
-    while(1)
+    loop.engine.setAngle(roll, pitch);
+    restore_state(loop.engine);
+    if (gyro_calibration.still)
+        loop.engine.setGyroBias(gyro_offset[0], gyro_offset[1], gyro_offset[2]);
+    columns_start(&columns, selected_columns, roll, pitch);
+    columns.integration = rate_integration;
+
+    if (both_conventions)
     {
-        read_sensor_data();
+        typedef typename FusionLoop<Engine>::SecondEngine SecondEngine;
+        second_convention_start(loop.second_engine, loop.engine);
+        apply_tuning(loop.second_engine);
+        accel_angles(SecondEngine::convention, accX, accY, accZ, &roll, &pitch);
+        loop.second_engine.setAngle(roll, pitch);
+        restore_state(loop.second_engine);
+        if (gyro_calibration.still)
+            loop.second_engine.setGyroBias(gyro_offset[0], gyro_offset[1], gyro_offset[2]);
+        columns_start(&columns_second, selected_columns, roll, pitch);
+        columns_second.integration = rate_integration;
+    }
+    loop.timer          = micros();
+    loop.start_micros   = loop.timer;
+    loop.sample_count   = 0;
+    loop.stats_start    = EventLoop::now();
+    loop.stats_samples  = 0;
+    loop.stats_longest  = 0;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (!loop.events.isValid() || !loop.events.watchSignals(signals, on_signal, &loop.events))
+    {
+        perror("event loop");
+        running = false;
+        return;
+    }
+    bool timed = pipeline_transaction_us >= 0;
+    if (fusion_rate_hz > 0)
+        loop.events.addTimer(EventLoop::now(), timed ? on_sample_timer<Engine, true> : on_sample_timer<Engine, false>, &loop);
+    else
+        loop.events.setIdle(timed ? on_idle_sample<Engine, true> : on_idle_sample<Engine, false>, &loop);
+    if (state_path || temp_model_path)
+        loop.events.addTimer(EventLoop::now() + STATE_SAVE_INTERVAL_SECONDS, on_save_timer<Engine>, &loop);
+    if (stats_interval_seconds > 0)
+        loop.events.addTimer(EventLoop::now() + stats_interval_seconds, on_stats_timer<Engine>, &loop);
+    if (control.isOpen())
+        control.attach(loop.events, on_control_command<Engine>, &loop);
+    loop.events.run();
 
-        temp_degrees_c              = ((double)temp_raw / 340.0) + 36.53;
-        seconds_passed              = (double)(micros() - timer) / 1000000;
-        timer                       = micros();
-        roll_gyro_rate_deg_per_sec  = convert_to_deg_per_sec(gyroX);
-        pitch_gyro_rate_deg_per_sec = convert_to_deg_per_sec(gyroY);
+    save_state(loop.engine);
+    save_temp_model();
+    fflush(stdout);
+    if (capture_file)
+        fflush(capture_file);
+}
 
-    #ifdef PITCH_RESTRICT_90_DEG
-        
-        /* Eq. 25 and 26 from source for equations */
-        roll  = atan2_deg(accY,accZ);
-        pitch = atan_deg(-accX, accY, accZ);
+template <AngleConvention convention>
+void run_selected_engine_in()
+{
+    switch (fusion_engine)
+    {
+    case FUSION_COMPLEMENTARY: run_fusion<typename EngineIn<ComplementaryEngine, convention>::type>(); break;
+    case FUSION_MADGWICK:      run_fusion<typename EngineIn<MadgwickEngine, convention>::type>();      break;
+    case FUSION_MAHONY:        run_fusion<typename EngineIn<MahonyEngine, convention>::type>();        break;
+    case FUSION_GRAVITY:       run_fusion<typename EngineIn<GravityEngine, convention>::type>();       break;
+    default:                   run_fusion<typename EngineIn<KalmanEngine, convention>::type>();        break;
+    }
+}
 
-        /* Let pitch have -90 and 90 degrees to be the continuous (and roll ±180) */
-        if ( abs(roll)<= 90 || abs(roll_kalman)<= 90 )
+/* The engine and its convention are chosen once here, the loop itself is compiled for each */
+void run_selected_engine()
+{
+    if (angle_convention == ROLL_RESTRICTED)
+        run_selected_engine_in<ROLL_RESTRICTED>();
+    else
+        run_selected_engine_in<PITCH_RESTRICTED>();
+}
+
+/* The loop of Pipeline.h compiled for the engine and the sink, on the bus, the ranges and the
+   rate of the program, until the run of the pipeline benchmark is over */
+template <class Engine, class Sink>
+void run_compiled(const Sink &sink)
+{
+    Pipeline<BusSource<SensorBusOn<WiringPiBus> >, Engine, Sink> pipeline;
+    bool more = true;
+    double due = pipeline_now();
+
+    pipeline.source.attach(&gyro_device, &full_scale_range, fusion_rate_hz > 0 ? &sample_rate : NULL);
+    pipeline.sink = sink;
+    apply_tuning(pipeline.engine);
+    if (!pipeline.start())
+        return;
+    while (more)
+    {
+        /* The simulated sensor always has a sample ready, so wait for the period as the sample timer does */
+        if (fusion_rate_hz > 0)
         {
-            /* Calculate roll_kalman */
-            roll_kalman = kalman_roll.getAngle(roll, roll_gyro_rate_deg_per_sec, seconds_passed);
+            struct timespec wake;
+            due += sample_rate.dt;
+            wake.tv_sec = (time_t)due;
+            wake.tv_nsec = (long)((due - floor(due)) * 1e9);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
         }
-        else
+        double sample_start = pipeline_now();
+        pipeline.step();
+        more = pipeline_stats_add(&pipeline_stats, sample_start);
+    }
+    fflush(stdout);
+}
+
+template <class Engine>
+void run_compiled_sink(OutputSink sink, FILE *capture_sink)
+{
+    PrintSink   print;
+    CaptureSink capture;
+    capture.file = capture_sink;
+    switch (sink)
+    {
+    case SINK_PRINT:   run_compiled<Engine>(print);      break;
+    case SINK_CAPTURE: run_compiled<Engine>(capture);    break;
+    default:           run_compiled<Engine>(NullSink()); break;
+    }
+}
+
+template <AngleConvention convention>
+void run_compiled_engine_in(OutputSink sink, FILE *capture_sink)
+{
+    switch (fusion_engine)
+    {
+    case FUSION_COMPLEMENTARY: run_compiled_sink<typename EngineIn<ComplementaryEngine, convention>::type>(sink, capture_sink); break;
+    case FUSION_MADGWICK:      run_compiled_sink<typename EngineIn<MadgwickEngine, convention>::type>(sink, capture_sink);      break;
+    case FUSION_MAHONY:        run_compiled_sink<typename EngineIn<MahonyEngine, convention>::type>(sink, capture_sink);        break;
+    case FUSION_GRAVITY:       run_compiled_sink<typename EngineIn<GravityEngine, convention>::type>(sink, capture_sink);       break;
+    default:                   run_compiled_sink<typename EngineIn<KalmanEngine, convention>::type>(sink, capture_sink);        break;
+    }
+}
+
+/* The compiled loop of the selected engine and convention with the sink, chosen once here */
+void run_compiled_engine(OutputSink sink, FILE *capture_sink)
+{
+    if (angle_convention == ROLL_RESTRICTED)
+        run_compiled_engine_in<ROLL_RESTRICTED>(sink, capture_sink);
+    else
+        run_compiled_engine_in<PITCH_RESTRICTED>(sink, capture_sink);
+}
+
+/* Runs the loop for PIPELINE_SECONDS_PER_RUN per fusion engine and output sink on the simulated
+   sensor, and then the loop of Pipeline.h compiled for them, and reports throughput and latency
+   of both on stderr (see PipelineStats.h). The printed columns go to stdout as usual, the
+   compiled loop prints those of -c fused, the capture sink writes to /dev/null */
+int run_pipeline_benchmark()
+{
+    FILE *capture_sink = fopen("/dev/null", "w");
+    if (!capture_sink)
+    {
+        perror("/dev/null");
+        return 1;
+    }
+
+    fprintf(stderr, "# %.0f us per register transaction, %.1f s per run\n", pipeline_transaction_us, PIPELINE_SECONDS_PER_RUN);
+    pipeline_stats_header(stderr);
+    for (int engine = 0; engine < FUSION_ENGINE_COUNT && running; engine++)
+        for (int sink = 0; sink < OUTPUT_SINK_COUNT && running; sink++)
         {
-            kalman_roll.setAngle(roll);
-            roll_complementary = roll;
-            roll_kalman        = roll;
-            roll_gyro          = roll;
+            fusion_engine    = (FusionEngineId)engine;
+            print_output     = sink == SINK_PRINT;
+            capture_file     = sink == SINK_CAPTURE ? capture_sink : NULL;
+            read_temperature = (print_output && (selected_columns & COLUMN_TEMP)) || temp_model_path || state_path || capture_file;
+            pipeline_stats_start(&pipeline_stats, PIPELINE_SECONDS_PER_RUN, gyro_device.getWaitedSeconds());
+            run_selected_engine();
+            if (pipeline_stats_complete(pipeline_stats))
+                pipeline_stats_report(stderr, &pipeline_stats, fusion_engine_names[engine], output_sink_names[sink],
+                                      "runtime", gyro_device.getWaitedSeconds());
+            if (!running)
+                break;
+
+            pipeline_stats_start(&pipeline_stats, PIPELINE_SECONDS_PER_RUN, gyro_device.getWaitedSeconds());
+            run_compiled_engine((OutputSink)sink, capture_sink);
+            pipeline_stats_report(stderr, &pipeline_stats, fusion_engine_names[engine], output_sink_names[sink],
+                                  "compiled", gyro_device.getWaitedSeconds());
         }
-        pitch_gyro_rate_deg_per_sec = max_90_deg_correction(pitch_gyro_rate_deg_per_sec, roll_kalman);
-        pitch_kalman                = kalman_pitch.getAngle(pitch, pitch_gyro_rate_deg_per_sec, seconds_passed);
 
-    #else
-        /* Eq. 28 and 29 from source for equations */
-        roll  = atan_deg(accY, accX, accZ);
-        pitch = atan2_deg(-accX,accZ);
+    fclose(capture_sink);
+    capture_file = NULL;
+    return running ? 0 : 1;
+}
+
+void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-e kalman|complementary|madgwick|mahony|gravity] [-a] [-B] [-c accel,gyro,complementary,fused,temp] [-C control.sock] [-d N] [-g 250|500|1000|2000] [-i euler|trapezoidal|quadratic] [-r 2|4|8|16] [-R] [-f rate_hz] [-k Q_angle:Q_bias:R_measure] [-m N] [-o offsets.txt] [-P transaction_us] [-s state.txt] [-S seconds] [-t tempmodel.txt] [-w capture.txt] [-x pitch|roll|both]\n", program);
+    fprintf(stderr, "  -e  Fusion engine shown in the filtered columns (default kalman)\n");
+    fprintf(stderr, "  -a  Adaptive Kalman measurement noise, from the acceleration and the angle difference\n");
+    fprintf(stderr, "  -B  Skip the gyro offset calibration at startup\n");
+    fprintf(stderr, "  -c  Columns to print (default all), the work for the others is skipped\n");
+    fprintf(stderr, "  -C  Take commands to get and set the tuning, the columns and the decimation on this Unix socket\n");
+    fprintf(stderr, "  -d  Print one in N samples, the gravity and quaternion engines only calculate angles for those\n");
+    fprintf(stderr, "  -g  Gyro full-scale range in degrees per second (default 250)\n");
+    fprintf(stderr, "  -r  Accelerometer full-scale range in g (default 2)\n");
+    fprintf(stderr, "  -R  Switch the full-scale ranges automatically, up on saturation and down when quiet\n");
+    fprintf(stderr, "  -f  Configure the sample rate and low-pass filter of the sensor for this fusion rate, and run at it\n");
+    fprintf(stderr, "  -i  Integration of the gyro rates (default euler), the Kalman filter uses trapezoidal for both higher orders\n");
+    fprintf(stderr, "  -k  Kalman filter tuning, as found by ito-mpu6050-tuner\n");
+    fprintf(stderr, "  -m  Correct the Kalman filter with the accelerometer at one in N samples, the gyro is integrated at all\n");
+    fprintf(stderr, "  -P  Benchmark the loop per engine and output sink on the simulated sensor, with this time per register read or write\n");
+    fprintf(stderr, "  -o  Write the offset registers made by ito-mpu6050-offsets to the sensor at startup\n");
+    fprintf(stderr, "  -s  Restore the Kalman bias and error covariance at startup, save them periodically and on exit\n");
+    fprintf(stderr, "  -S  Print the sample rate and the longest time between two samples on stderr every this many seconds\n");
+    fprintf(stderr, "  -t  Learn the gyro bias versus temperature, keep it in this file and compensate the rates with it\n");
+    fprintf(stderr, "  -w  Record the raw samples to a capture file for replay by the tools\n");
+    fprintf(stderr, "  -x  Axis restricted to ±90 degrees (default pitch), or both to also print the angles with roll restricted\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int option;
 
-        /* Let roll have -90 and 90 degrees to be the continuous (and pitch ±180) */
-        if ( abs(pitch)<= 90 || abs(pitch_kalman)<= 90 )
+    while ((option = getopt(argc, argv, "aBc:C:d:e:f:g:i:k:m:o:P:r:Rs:S:t:w:x:h")) != -1)
+    {
+        switch (option)
         {
-            /* Calculate pitch_kalman */
-            pitch_kalman = kalman_pitch.getAngle(pitch, pitch_gyro_rate_deg_per_sec, seconds_passed);
+        case 'c':
+            selected_columns = columns_from_list(optarg);
+            if (!selected_columns)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'C':
+            control_path = optarg;
+            break;
+        case 'd':
+            output_decimation = atoi(optarg);
+            if (output_decimation < 1)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'e':
+            fusion_engine = fusion_engine_from_name(optarg);
+            if (fusion_engine == FUSION_ENGINE_COUNT)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'a':
+            kalman_adaptive = true;
+            break;
+        case 'B':
+            calibrate_gyro = false;
+            break;
+        case 'f':
+            fusion_rate_hz = atof(optarg);
+            if (fusion_rate_hz <= 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'g':
+            gyro_full_scale = full_scale_from_range(gyro_ranges_deg_per_sec, atoi(optarg));
+            if (gyro_full_scale < 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            accel_full_scale = full_scale_from_range(accel_ranges_g, atoi(optarg));
+            if (accel_full_scale < 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'R':
+            auto_range = true;
+            break;
+        case 'i':
+            rate_integration = rate_integration_from_name(optarg);
+            if (rate_integration == RATE_INTEGRATION_COUNT)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'k':
+            if (sscanf(optarg, "%lf:%lf:%lf", &kalman_Q_angle, &kalman_Q_bias, &kalman_R_measure) != 3)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            kalman_tuned = true;
+            break;
+        case 'm':
+            kalman_correction_interval = atoi(optarg);
+            if (kalman_correction_interval < 1)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o':
+            offsets_path = optarg;
+            break;
+        case 'P':
+            pipeline_transaction_us = atof(optarg);
+            if (pipeline_transaction_us < 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            gyro_device.simulate(pipeline_transaction_us);
+            break;
+        case 's':
+            state_path = optarg;
+            break;
+        case 'S':
+            stats_interval_seconds = atof(optarg);
+            if (stats_interval_seconds <= 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            temp_model_path = optarg;
+            break;
+        case 'w':
+            capture_file = fopen(optarg, "w");
+            if (!capture_file)
+            {
+                perror(optarg);
+                return 1;
+            }
+            capture_write_header(capture_file);
+            break;
+        case 'x':
+            both_conventions = strcmp(optarg, "both") == 0;
+            if (!both_conventions)
+                angle_convention = angle_convention_from_name(optarg);
+            if (angle_convention == ANGLE_CONVENTION_COUNT)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
         }
-        else
+    }
+
+    gyro_device.setup(MPU6050_I2C_DEVICE_ADDRESS);
+    gyro_device.writeReg8(REGISTER_FOR_POWER_MANAGEMENT,SLEEP_MODE_DISABLED);
+    range_configure(gyro_device, &full_scale_range, gyro_full_scale, accel_full_scale, auto_range);
+    if (fusion_rate_hz > 0)
+    {
+        sample_rate_choose(fusion_rate_hz, &sample_rate);
+        sample_rate_configure(gyro_device, sample_rate);
+        fprintf(stderr, "Sample rate %.1f Hz, low-pass filter %.0f Hz (DLPF_CFG %d, %.1f ms delay)\n",
+                sample_rate.output_rate_hz, dlpf_gyro_bandwidth_hz[sample_rate.dlpf_cfg], sample_rate.dlpf_cfg,
+                dlpf_gyro_delay_ms[sample_rate.dlpf_cfg]);
+    }
+
+    /* With the offsets in the sensor, the samples arrive corrected */
+    if (offsets_path)
+    {
+        SensorOffsets offsets;
+        if (!offsets_load(offsets_path, MPU6050_DEVICE_NAME, &offsets))
         {
-            kalman_pitch.setAngle(pitch);
-            pitch_complementary = pitch;
-            pitch_kalman        = pitch;
-            pitch_gyro          = pitch;
+            fprintf(stderr, "%s: no offsets for %s\n", offsets_path, MPU6050_DEVICE_NAME);
+            return 1;
         }
-        roll_gyro_rate_deg_per_sec = max_90_deg_correction(roll_gyro_rate_deg_per_sec, pitch_kalman);
-        roll_kalman                = kalman_roll.getAngle(roll, roll_gyro_rate_deg_per_sec, seconds_passed);
-    #endif
+        write_offsets(gyro_device, offsets);
+    }
 
-        /* Calculate gyro angles without any filter */
-        roll_gyro  += roll_gyro_rate_deg_per_sec * seconds_passed;
-        pitch_gyro += pitch_gyro_rate_deg_per_sec * seconds_passed;
+    /* Wait for the first sample after wake-up */
+    if (!wait_for_sensor_ready())
+        fprintf(stderr, "No data ready from the sensor after %d ms, starting anyway\n", SENSOR_READY_TIMEOUT_MS);
 
-        /* Calculate gyro angle using the unbiased rate */
-        //roll_gyro += kalman_roll.getRate() * seconds_passed;
-        //pitch_gyro += kalman_pitch.getRate() * seconds_passed;
+    temp_model_reset(&temp_model);
+    if (temp_model_path)
+        temp_model_load(temp_model_path, MPU6050_DEVICE_NAME, &temp_model);
 
-        roll_gyro  = max_drift_correction(roll_gyro, roll_kalman);
-        pitch_gyro = max_drift_correction(pitch_gyro, pitch_kalman);
+    gyro_calibration_reset(&gyro_calibration);
+    if (calibrate_gyro)
+        run_gyro_calibration();
 
-        /* Calculate the angle using a Complimentary filter */
-        roll_complementary  = 0.93 * (roll_complementary + roll_gyro_rate_deg_per_sec * seconds_passed) + 0.07 * roll;
-        pitch_complementary = 0.93 * (pitch_complementary + pitch_gyro_rate_deg_per_sec * seconds_passed) + 0.07 * pitch;
+    /* From here on the temperature is only read when it is printed or needed for a file */
+    read_temperature = (selected_columns & COLUMN_TEMP) || temp_model_path || state_path || capture_file;
 
-        print_columns();
-        counter++;
+    if (control_path && !control.open(control_path))
+    {
+        perror(control_path);
+        return 1;
     }
+
+    if (pipeline_transaction_us >= 0)
+        return run_pipeline_benchmark();
+    run_selected_engine();
+
+    if (capture_file)
+        fclose(capture_file);
+    control.close();
+    return 0;
 }
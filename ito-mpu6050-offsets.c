@@ -0,0 +1,134 @@
+/*
+ Calibrates the MPU6050 offset registers, see OffsetCalibration.h.
+
+   ito-mpu6050-offsets offsets.txt   Calibrates the sensor and saves the offsets. The sensor
+                                     must lie flat and still, Z axis up.
+   ito-mpu6050-offsets -S            Verifies the calibration on the simulated register
+                                     backend, against known biases.
+
+ Pass the saved file to the demonstration program with -o offsets.txt, which writes the
+ offsets to the sensor at startup.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#include <wiringPi.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "WiringPiBus.h"
+#include "SimulatedMpu6050.h"
+#include "OffsetCalibration.h"
+
+void print_result(const SensorOffsets &offsets, const double residual[6])
+{
+    const int *v = offsets.value;
+    printf("offsets   xa %d ya %d za %d xg %d yg %d zg %d\n", v[0], v[1], v[2], v[3], v[4], v[5]);
+    printf("residual  ax %.1f ay %.1f az %.1f gx %.1f gy %.1f gz %.1f (raw LSB)\n",
+           residual[0], residual[1], residual[2], residual[3], residual[4], residual[5]);
+}
+
+int calibrate_sensor(const char *path)
+{
+    WiringPiBus bus;
+    SensorOffsets offsets;
+    double residual[6];
+
+    bus.setup(MPU6050_I2C_DEVICE_ADDRESS);
+    bus.writeReg8(REGISTER_FOR_POWER_MANAGEMENT, SLEEP_MODE_DISABLED);
+    delay(150);
+
+    bool within_tolerance = calibrate_offsets(bus, &offsets, residual);
+    print_result(offsets, residual);
+    if (!within_tolerance)
+    {
+        fprintf(stderr, "Residual error too large, was the sensor lying flat and still?\n");
+        return 1;
+    }
+    if (!offsets_save(path, MPU6050_DEVICE_NAME, offsets))
+    {
+        perror(path);
+        return 1;
+    }
+    return 0;
+}
+
+/* Calibrates a simulated sensor with known biases, and checks that its samples come out corrected */
+int verify_on_simulated_sensor()
+{
+    SimulatedMpu6050 sensor;
+    SensorOffsets offsets;
+    SensorOffsets factory;
+    double residual[6];
+    double error[6];
+    int failures = 0;
+
+    double accel_bias[3] = { 0.05, -0.03, 0.08 };
+    double gyro_bias[3]  = { 3.0, -2.0, 1.5 };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        sensor.accel_bias_g[axis]          = accel_bias[axis];
+        sensor.gyro_bias_deg_per_sec[axis] = gyro_bias[axis];
+    }
+    sensor.accel_noise_g          = 0.004;
+    sensor.gyro_noise_deg_per_sec = 0.05;
+
+    /* Factory values in the accel offsets, with the reserved bit set on one axis */
+    factory.value[0] = 1200;
+    factory.value[1] = -800;
+    factory.value[2] = 1501;
+    factory.value[3] = 0;
+    factory.value[4] = 0;
+    factory.value[5] = 0;
+    write_offsets(sensor, factory);
+    sensor.writeReg8(REGISTER_FOR_POWER_MANAGEMENT, SLEEP_MODE_DISABLED);
+
+    bool within_tolerance = calibrate_offsets(sensor, &offsets, residual);
+    print_result(offsets, residual);
+    if (!within_tolerance)
+    {
+        printf("FAIL: residual error out of tolerance\n");
+        failures++;
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+        if ((offsets.value[axis] & 1) != (factory.value[axis] & 1))
+        {
+            printf("FAIL: reserved bit 0 of accel offset %d changed\n", axis);
+            failures++;
+        }
+
+    /* The offsets must be in the registers, so a fresh measurement is corrected too */
+    read_offsets(sensor, &factory);
+    if (memcmp(&factory, &offsets, sizeof(offsets)) != 0)
+    {
+        printf("FAIL: offset registers do not hold the calibration\n");
+        failures++;
+    }
+    measure_error(sensor, OFFSET_CALIBRATION_SAMPLES, error);
+    for (int axis = 0; axis < 6; axis++)
+        if (fabs(error[axis]) > (axis < 3 ? OFFSET_ACCEL_TOLERANCE : OFFSET_GYRO_TOLERANCE))
+        {
+            printf("FAIL: axis %d still reads %.1f LSB off\n", axis, error[axis]);
+            failures++;
+        }
+
+    printf(failures ? "FAIL\n" : "PASS\n");
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 2 && strcmp(argv[1], "-S") == 0)
+        return verify_on_simulated_sensor();
+    if (argc == 2 && argv[1][0] != '-')
+        return calibrate_sensor(argv[1]);
+
+    fprintf(stderr, "Usage: %s offsets.txt | -S\n", argv[0]);
+    return 1;
+}
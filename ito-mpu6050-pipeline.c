@@ -0,0 +1,157 @@
+/*
+ A deployment of Pipeline.h: the acquire, fuse and print loop of the demonstration program
+ compiled for one configuration, the Kalman engine on the sensor on I2C, printing roll and
+ pitch for every sample.
+
+   ito-mpu6050-pipeline [-n samples]      Runs on the sensor until Ctrl-C, or for the samples
+   ito-mpu6050-pipeline -S [-n samples]   Runs the same loop on the simulated sensor
+
+ The configuration is the engine and the sink below and the bus of BusSource. Another
+ deployment changes them and is compiled again, and gets a loop without a check for the
+ parts it does not have. The sensor is read as the demonstration program reads it, and
+ -g, -r, -R and -f set the full-scale ranges and the rate as they do there. The
+ demonstration program is the build that is configured at runtime; its pipeline benchmark
+ (-P) compares the two.
+
+ Compile with g++ -O2 -o ito-mpu6050-pipeline ito-mpu6050-pipeline.c -lwiringPi -lm
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#include <wiringPi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+/* Same convention and angle math as ito-mpu6050-kalman-raspberry.c */
+#define PITCH_RESTRICT_90_DEG
+#define FAST_ATAN
+
+#include "WiringPiBus.h"
+#include "SimulatedMpu6050.h"
+#include "Pipeline.h"
+
+/* The configuration of this deployment */
+typedef KalmanEngine DeployedEngine;
+typedef PrintSink    DeployedSink;
+
+int gyro_full_scale = 0;      /* FS_SEL, ±250 degrees per second */
+int accel_full_scale = 0;     /* AFS_SEL, ±2 g */
+bool auto_range = false;      /* Step the full-scale ranges up on saturation and down when quiet */
+double rate_hz = 0;           /* When set, the sensor is configured for this rate and the loop waits for its samples */
+volatile sig_atomic_t running = 1;
+
+void on_signal(int)
+{
+    running = 0;
+}
+
+void setup_bus(WiringPiBus &bus)
+{
+    bus.setup(MPU6050_I2C_DEVICE_ADDRESS);
+}
+
+/* Flat and still, with the noise densities of the datasheet as in SensorBus.h */
+void setup_bus(SimulatedMpu6050 &sensor)
+{
+    sensor.accel_noise_g = 0.006;
+    sensor.gyro_noise_deg_per_sec = 0.08;
+}
+
+/* Runs the loop for the samples, or until a signal when 0 */
+template <class Bus>
+int run_pipeline(long samples)
+{
+    Pipeline<BusSource<Bus>, DeployedEngine, DeployedSink> pipeline;
+    Bus bus;
+    FullScaleRange range;
+    SampleRateConfig rate;
+
+    setup_bus(bus);
+    bus.writeReg8(REGISTER_FOR_POWER_MANAGEMENT, SLEEP_MODE_DISABLED);
+    range_configure(bus, &range, gyro_full_scale, accel_full_scale, auto_range);
+    if (rate_hz > 0)
+    {
+        sample_rate_choose(rate_hz, &rate);
+        sample_rate_configure(bus, rate);
+    }
+    pipeline.source.attach(&bus, &range, rate_hz > 0 ? &rate : NULL);
+    delay(150);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    pipeline.start();
+    for (long n = 0; running && (samples == 0 || n < samples); n++)
+        pipeline.step();
+    fflush(stdout);
+    return 0;
+}
+
+void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-S] [-n samples] [-g 250|500|1000|2000] [-r 2|4|8|16] [-R] [-f rate_hz]\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+    bool simulated = false;
+    long samples = 0;
+    int option;
+    while ((option = getopt(argc, argv, "f:g:n:r:RSh")) != -1)
+    {
+        switch (option)
+        {
+        case 'f':
+            rate_hz = atof(optarg);
+            if (rate_hz <= 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'g':
+            gyro_full_scale = full_scale_from_range(gyro_ranges_deg_per_sec, atoi(optarg));
+            if (gyro_full_scale < 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            accel_full_scale = full_scale_from_range(accel_ranges_g, atoi(optarg));
+            if (accel_full_scale < 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'R':
+            auto_range = true;
+            break;
+        case 'n':
+            samples = atol(optarg);
+            break;
+        case 'S':
+            simulated = true;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc || samples < 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (simulated)
+        return run_pipeline<SimulatedMpu6050>(samples);
+    return run_pipeline<WiringPiBus>(samples);
+}
@@ -0,0 +1,437 @@
+/*
+ Reads and fuses many MPU6050 sensors on one thread with coroutines, and compares that to
+ one thread per sensor.
+
+   ito-mpu6050-scheduler [-n sensors] [-f rate_hz] [-s seconds] [-c bus_clock_hz]
+                         [-b /dev/i2c-1 [-i /dev/gpiochip0:line,line]]
+
+ Runs the sensors on simulated hardware (SimulatedMpu6050.h) that share one I2C bus, and
+ each reads a burst of the accel, temperature and gyro registers at the rate and fuses it
+ with the Kalman engine. The sensors are spread evenly over the sample period, as
+ sensors that are not synchronized would be. With -b the sensors are real ones on that
+ bus (I2CDevBus.h), at most two as the MPU6050 has two addresses (0x68 and 0x69), set to
+ the nearest sample rate of SampleRate.h. With -i as well, each sensor is read when its
+ data ready interrupt arrives on its GPIO line, the first line for the sensor at 0x68,
+ instead of at the times spread over the period. Both ways are run for the same time:
+
+   coroutines  one thread, a coroutine per sensor on the loop of EventLoop.h, suspended
+               until its sample is due and until its transfer on the bus is done (see
+               SensorScheduler.h)
+   threads     a thread per sensor, that sleeps until its sample is due and then holds
+               the bus for the time of the transfer
+
+ and for each the samples read, the CPU time per sample, the latency from the time a
+ sample is due, or from its interrupt with -i, to its fused angles (50th and 99th
+ percentile and maximum) and the samples that missed their period are printed. A real bus
+ on i2c-dev blocks for the transfer instead, see SensorScheduler.h. More than two sensors
+ need several buses or an I2C multiplexer.
+
+ Compile with g++ -std=c++20 -O2 -o ito-mpu6050-scheduler ito-mpu6050-scheduler.c -lm -lpthread
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Same convention as ito-mpu6050-kalman-raspberry.c */
+#define PITCH_RESTRICT_90_DEG
+
+#include "FusionEngine.h"
+#include "I2CDevBus.h"
+#include "SampleRate.h"
+#include "SensorScheduler.h"
+
+#define DEFAULT_SENSORS                24
+#define DEFAULT_RATE_HZ                50
+#define DEFAULT_SECONDS                5.0
+#define DEFAULT_BUS_CLOCK_HZ           400000
+#define BURST_REGISTERS                14    /* ACCEL_XOUT_H to GYRO_ZOUT_L */
+#define START_DELAY_SECONDS            0.01
+#define MAX_HARDWARE_SENSORS           2     /* The two addresses of the MPU6050 */
+#define RUN_TIMEOUT_SECONDS            1.0   /* After the time of a run, for a data ready line that stays quiet */
+
+int sensor_count       = DEFAULT_SENSORS;
+double rate_hz         = DEFAULT_RATE_HZ;
+double period          = 1 / DEFAULT_RATE_HZ; /* Of the samples, on hardware as the sensor runs */
+double run_seconds     = DEFAULT_SECONDS;
+double bus_clock_hz    = DEFAULT_BUS_CLOCK_HZ;
+const char *i2c_path   = NULL;
+const char *gpio_chip  = NULL;
+int gpio_lines[MAX_HARDWARE_SENSORS];
+
+/* A sensor on I2C (-b), and its data ready line (-i) */
+struct SensorHardware {
+    I2CDevBus    bus;
+    DataReadyPin pin;
+};
+
+SensorHardware hardware[MAX_HARDWARE_SENSORS];
+
+/* A sensor with its filter and the latency of each of its samples */
+struct SensorSlot {
+    SimulatedMpu6050    sensor;
+    KalmanEngine        engine;
+    bool                started;
+    double              roll;
+    double              pitch;
+    long                failed_reads;
+    std::vector<double> latency_us;
+};
+
+void make_sensors(std::vector<SensorSlot> *slots)
+{
+    slots->clear();
+    slots->resize(sensor_count);
+    for (int i = 0; i < sensor_count; i++)
+    {
+        SensorSlot &slot = (*slots)[i];
+        slot.sensor.writeReg8(REGISTER_FOR_POWER_MANAGEMENT, SLEEP_MODE_DISABLED);
+        slot.sensor.acc_g[0] = -0.1;
+        slot.sensor.acc_g[1] = 0.02 * (i % 10);
+        slot.sensor.acc_g[2] = 0.99;
+        slot.sensor.accel_noise_g = 0.005;
+        slot.sensor.gyro_noise_deg_per_sec = 0.05;
+        slot.started = false;
+        slot.failed_reads = 0;
+    }
+}
+
+/* Wakes the sensors on the bus of -b, sets their sample rate and, with -i, their data ready
+   interrupt, and requests its lines */
+bool setup_hardware()
+{
+    SampleRateConfig config;
+    sample_rate_choose(rate_hz, &config);
+    period = config.dt;
+    for (int i = 0; i < sensor_count; i++)
+    {
+        I2CDevBus &bus = hardware[i].bus;
+        int address = MPU6050_I2C_DEVICE_ADDRESS + i;
+        if (!bus.open(i2c_path, address))
+        {
+            perror(i2c_path);
+            return false;
+        }
+        if (bus.readReg8(REGISTER_FOR_WHO_AM_I) < 0)
+        {
+            fprintf(stderr, "No sensor at 0x%02x on %s\n", address, i2c_path);
+            return false;
+        }
+        bus.writeReg8(REGISTER_FOR_POWER_MANAGEMENT, SLEEP_MODE_DISABLED);
+        sample_rate_configure(bus, config);
+        if (!gpio_chip)
+            continue;
+        bus.writeReg8(REGISTER_FOR_INT_ENABLE, DATA_READY);
+        if (!hardware[i].pin.open(gpio_chip, gpio_lines[i]))
+        {
+            fprintf(stderr, "%s line %d: %s\n", gpio_chip, gpio_lines[i], strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Parses chip:line,line of -i, one line per sensor */
+bool parse_gpio(char *text)
+{
+    char *lines = strrchr(text, ':');
+    if (!lines)
+        return false;
+    *lines++ = 0;
+    gpio_chip = text;
+    for (int i = 0; i < sensor_count; i++)
+    {
+        char *end;
+        gpio_lines[i] = (int)strtol(lines, &end, 10);
+        if (end == lines || gpio_lines[i] < 0 || *end != (i + 1 < sensor_count ? ',' : 0))
+            return false;
+        lines = end + 1;
+    }
+    return true;
+}
+
+int word_2c(const unsigned char *data)
+{
+    int val = (data[0] << 8) | data[1];
+    return val >= 0x8000 ? val - 65536 : val;
+}
+
+/* Fuses a burst of registers from ACCEL_XOUT_H on */
+void fuse_sample(SensorSlot *slot, const unsigned char *data, double dt)
+{
+    ImuSample sample = imu_sample_from_raw(word_2c(data), word_2c(data + 2), word_2c(data + 4),
+                                           word_2c(data + 8), word_2c(data + 10), word_2c(data + 12));
+    if (!slot->started)
+    {
+        slot->engine.setAngle(sample.roll, sample.pitch);
+        slot->started = true;
+    }
+    slot->engine.getAngle(sample, dt, &slot->roll, &slot->pitch);
+}
+
+double process_cpu_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* The sample times of sensor i: spread evenly over the period */
+double first_due(double start, int i)
+{
+    return start + i / rate_hz / sensor_count;
+}
+
+/* Reads the sensor when its sample is due, or when its data ready pin has an edge */
+template <class Bus>
+Task sensor_task(EventLoop &loop, Bus &bus, typename Bus::Device &device, DataReadyPin *pin, SensorSlot &slot,
+                 double due, int samples, int *running_tasks)
+{
+    unsigned char data[BURST_REGISTERS];
+    for (int n = 0; n < samples; n++)
+    {
+        if (pin)
+            due = co_await pin->wait();
+        else
+            co_await SleepUntil(loop, due);
+        if (co_await bus.read(device, REGISTER_FOR_ACCEL_XOUT_H, data, BURST_REGISTERS))
+        {
+            fuse_sample(&slot, data, period);
+            slot.latency_us.push_back((EventLoop::now() - due) * 1000000);
+        }
+        else
+            slot.failed_reads++;
+        due += period;
+    }
+    if (--*running_tasks == 0)
+        loop.stop();
+}
+
+void stop_loop(void *context)
+{
+    ((EventLoop *)context)->stop();
+}
+
+void run_coroutines(std::vector<SensorSlot> &slots, int samples)
+{
+    EventLoop loop;
+    SimulatedI2CBus bus(loop, bus_clock_hz);
+    BlockingI2CBus<I2CDevBus> device_bus;
+    int running_tasks = sensor_count;
+    double start = EventLoop::now() + START_DELAY_SECONDS;
+    for (int i = 0; i < sensor_count; i++)
+    {
+        DataReadyPin *pin = gpio_chip ? &hardware[i].pin : NULL;
+        if (pin)
+        {
+            pin->flush();
+            pin->attach(loop);
+        }
+        if (i2c_path)
+            sensor_task(loop, device_bus, hardware[i].bus, pin, slots[i], first_due(start, i), samples, &running_tasks);
+        else
+            sensor_task(loop, bus, slots[i].sensor, pin, slots[i], first_due(start, i), samples, &running_tasks);
+    }
+    if (gpio_chip)
+        loop.addTimer(start + run_seconds + RUN_TIMEOUT_SECONDS, stop_loop, &loop);
+    loop.run();
+}
+
+void sleep_until(double due)
+{
+    struct timespec until;
+    until.tv_sec  = (time_t)due;
+    until.tv_nsec = (long)((due - (time_t)due) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) != 0)
+        ;
+}
+
+/* A burst read from ACCEL_XOUT_H on, holding the bus for the time of the transfer */
+bool thread_read(SimulatedMpu6050 &sensor, unsigned char *data)
+{
+    double transfer_seconds = (I2C_READ_OVERHEAD_BYTES + BURST_REGISTERS) * I2C_BITS_PER_BYTE / bus_clock_hz;
+    sleep_until(EventLoop::now() + transfer_seconds);
+    for (int i = 0; i < BURST_REGISTERS; i++)
+        data[i] = sensor.readReg8(REGISTER_FOR_ACCEL_XOUT_H + i);
+    return true;
+}
+
+bool thread_read(I2CDevBus &device, unsigned char *data)
+{
+    return device.readBlock(REGISTER_FOR_ACCEL_XOUT_H, data, BURST_REGISTERS);
+}
+
+template <class Device>
+void sensor_thread(SensorSlot *slot, Device *device, DataReadyPin *pin, std::mutex *bus, double due, int samples)
+{
+    unsigned char data[BURST_REGISTERS];
+    double deadline = due + run_seconds + RUN_TIMEOUT_SECONDS;
+    prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0); // Wake up as precisely as the timerfd of the loop does
+    for (int n = 0; n < samples; n++)
+    {
+        if (pin)
+        {
+            due = pin->waitBlocking(deadline);
+            if (due < 0)
+                break;
+        }
+        else
+            sleep_until(due);
+        bool read;
+        {
+            std::lock_guard<std::mutex> lock(*bus);
+            read = thread_read(*device, data);
+        }
+        if (read)
+        {
+            fuse_sample(slot, data, period);
+            slot->latency_us.push_back((EventLoop::now() - due) * 1000000);
+        }
+        else
+            slot->failed_reads++;
+        due += period;
+    }
+}
+
+void run_threads(std::vector<SensorSlot> &slots, int samples)
+{
+    std::mutex bus;
+    std::vector<std::thread> threads;
+    double start = EventLoop::now() + START_DELAY_SECONDS;
+    for (int i = 0; i < sensor_count; i++)
+    {
+        DataReadyPin *pin = gpio_chip ? &hardware[i].pin : NULL;
+        if (pin)
+            pin->flush();
+        if (i2c_path)
+            threads.push_back(std::thread(sensor_thread<I2CDevBus>, &slots[i], &hardware[i].bus, pin, &bus, first_due(start, i), samples));
+        else
+            threads.push_back(std::thread(sensor_thread<SimulatedMpu6050>, &slots[i], &slots[i].sensor, pin, &bus, first_due(start, i), samples));
+    }
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+}
+
+void report(const char *mode, std::vector<SensorSlot> &slots, double cpu_seconds)
+{
+    std::vector<double> latency_us;
+    long failed_reads = 0;
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        latency_us.insert(latency_us.end(), slots[i].latency_us.begin(), slots[i].latency_us.end());
+        failed_reads += slots[i].failed_reads;
+    }
+    if (failed_reads > 0)
+        fprintf(stderr, "%s: %ld reads failed\n", mode, failed_reads);
+    std::sort(latency_us.begin(), latency_us.end());
+    size_t count = latency_us.size();
+    if (count == 0)
+    {
+        printf("%-12s %10zu\n", mode, count);
+        return;
+    }
+    size_t missed = latency_us.end() - std::upper_bound(latency_us.begin(), latency_us.end(), period * 1000000);
+    printf("%-12s %10zu %10.2f %10.1f %10.1f %10.1f %8zu\n", mode, count, cpu_seconds * 1000000 / count,
+           latency_us[count / 2], latency_us[count * 99 / 100], latency_us[count - 1], missed);
+}
+
+void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-n sensors] [-f rate_hz] [-s seconds] [-c bus_clock_hz] [-b /dev/i2c-1 [-i /dev/gpiochip0:line,line]]\n", program);
+    fprintf(stderr, "  -b  Read up to %d sensors on this I2C bus, at 0x68 and 0x69, instead of simulated ones\n", MAX_HARDWARE_SENSORS);
+    fprintf(stderr, "  -i  Read each sensor at its data ready interrupt, on these lines of the GPIO chip in the order of the addresses\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int option;
+    char *gpio = NULL;
+    while ((option = getopt(argc, argv, "b:c:f:i:n:s:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'b':
+            i2c_path = optarg;
+            break;
+        case 'i':
+            gpio = optarg;
+            break;
+        case 'c':
+            bus_clock_hz = atof(optarg);
+            break;
+        case 'f':
+            rate_hz = atof(optarg);
+            break;
+        case 'n':
+            sensor_count = atoi(optarg);
+            break;
+        case 's':
+            run_seconds = atof(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc || sensor_count < 1 || rate_hz <= 0 || run_seconds <= 0 || bus_clock_hz <= 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (i2c_path && sensor_count > MAX_HARDWARE_SENSORS)
+    {
+        fprintf(stderr, "At most %d sensors on one bus\n", MAX_HARDWARE_SENSORS);
+        return 1;
+    }
+    if (gpio && (!i2c_path || !parse_gpio(gpio)))
+    {
+        fprintf(stderr, "-i needs -b, and a line for each of the %d sensors\n", sensor_count);
+        print_usage(argv[0]);
+        return 1;
+    }
+    period = 1 / rate_hz;
+    if (i2c_path && !setup_hardware())
+        return 1;
+
+    int samples = (int)(run_seconds / period);
+    if (samples < 1)
+    {
+        fprintf(stderr, "Less than one sample per sensor in %g s at %g Hz\n", run_seconds, rate_hz);
+        print_usage(argv[0]);
+        return 1;
+    }
+    double transfer_seconds = (I2C_READ_OVERHEAD_BYTES + BURST_REGISTERS) * I2C_BITS_PER_BYTE / bus_clock_hz;
+    double bus_load = sensor_count / period * transfer_seconds;
+    printf("# %d sensors at %.0f Hz for %.1f s, %.0f kHz bus: %.0f us per sample, %.0f%% busy\n", sensor_count, 1 / period,
+           run_seconds, bus_clock_hz / 1000, transfer_seconds * 1000000, bus_load * 100);
+    if (i2c_path)
+        printf("# On %s%s\n", i2c_path, gpio_chip ? ", at the data ready interrupts" : "");
+    if (bus_load > 1)
+        fprintf(stderr, "The bus can not keep up with this many sensors at this rate\n");
+    printf("%-12s %10s %10s %10s %10s %10s %8s\n", "mode", "samples", "cpu_us", "p50_us", "p99_us", "max_us", "missed");
+
+    std::vector<SensorSlot> slots;
+    make_sensors(&slots);
+    double cpu_start = process_cpu_seconds();
+    run_coroutines(slots, samples);
+    report("coroutines", slots, process_cpu_seconds() - cpu_start);
+
+    make_sensors(&slots);
+    cpu_start = process_cpu_seconds();
+    run_threads(slots, samples);
+    report("threads", slots, process_cpu_seconds() - cpu_start);
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ Offline Rauch-Tung-Striebel smoother for recorded captures.
+
+ The demonstration program can only print the causal estimate of Kalman::getAngle(), which
+ only knows about the past samples. For analysis after the fact this tool gives the best
+ estimate using all the samples, see KalmanSmoother.h.
+
+   ito-mpu6050-smoother [-s segment] [-v overlap] [-j threads] capture.txt > smoothed.txt
+
+ Long captures are split into segments of 'segment' samples that are smoothed on all cores.
+ Each segment is extended with 'overlap' samples on both sides, which are smoothed but
+ thrown away, so the filter has converged and the backward pass has settled where the
+ segments meet. The output has one line per sample: t_us roll pitch. The throughput in
+ samples/s is reported on stderr.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/* Same convention as ito-mpu6050-kalman-raspberry.c */
+#define PITCH_RESTRICT_90_DEG
+
+#include "FusionEngine.h"
+#include "KalmanSmoother.h"
+#include "Capture.h"
+
+#define DEFAULT_SEGMENT_SAMPLES        20000
+#define DEFAULT_OVERLAP_SAMPLES        2000
+
+int segment_samples = DEFAULT_SEGMENT_SAMPLES;
+int overlap_samples = DEFAULT_OVERLAP_SAMPLES;
+int thread_count    = 0;
+
+double now_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Smooths one axis, one overlapping segment per task, on thread_count threads */
+void smooth_axis(const std::vector<double> &angle, const std::vector<double> &rate,
+                 const std::vector<double> &dt, std::vector<double> *smoothed)
+{
+    int count    = (int)angle.size();
+    int segments = (count + segment_samples - 1) / segment_samples;
+    std::atomic<int> next_segment(0);
+
+    smoothed->resize(count);
+
+    auto worker = [&]() {
+        KalmanSmoother smoother;
+        std::vector<double> result;
+        int segment;
+        while ((segment = next_segment++) < segments)
+        {
+            int start = segment * segment_samples;
+            int end   = std::min(count, start + segment_samples);
+            int first = std::max(0, start - overlap_samples);
+            int last  = std::min(count, end + overlap_samples);
+
+            result.resize(last - first);
+            smoother.smooth(&angle[first], &rate[first], &dt[first], last - first, &result[0]);
+            for (int i = start; i < end; i++)
+                (*smoothed)[i] = result[i - first];
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < thread_count; t++)
+        threads.push_back(std::thread(worker));
+    worker();
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+}
+
+void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-s segment] [-v overlap] [-j threads] capture.txt\n", program);
+    fprintf(stderr, "  -s  Samples per segment (default %d)\n", DEFAULT_SEGMENT_SAMPLES);
+    fprintf(stderr, "  -v  Overlap in samples on each side of a segment (default %d)\n", DEFAULT_OVERLAP_SAMPLES);
+    fprintf(stderr, "  -j  Threads (default all cores)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int option;
+
+    while ((option = getopt(argc, argv, "s:v:j:h")) != -1)
+    {
+        switch (option)
+        {
+        case 's': segment_samples = atoi(optarg); break;
+        case 'v': overlap_samples = atoi(optarg); break;
+        case 'j': thread_count    = atoi(optarg); break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || segment_samples <= 0 || overlap_samples < 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (thread_count <= 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<CaptureRecord> records;
+    if (!capture_load(argv[optind], &records) || records.empty())
+    {
+        fprintf(stderr, "%s: cannot read capture\n", argv[optind]);
+        return 1;
+    }
+
+    double start = now_seconds();
+
+    size_t count = records.size();
+    std::vector<double> dt(count), roll(count), roll_rate(count), pitch(count), pitch_rate(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        ImuSample sample = imu_sample_from_raw(records[i].accX, records[i].accY, records[i].accZ,
+                                               records[i].gyroX, records[i].gyroY, records[i].gyroZ);
+        dt[i]         = i == 0 ? 0 : (records[i].t_us - records[i-1].t_us) / 1000000;
+        roll[i]       = sample.roll;
+        roll_rate[i]  = sample.roll_rate;
+        pitch[i]      = sample.pitch;
+        pitch_rate[i] = sample.pitch_rate;
+    }
+
+    /* The continuous axis is smoothed first, as it decides the sign of the restricted axis rate */
+    std::vector<double> roll_smoothed, pitch_smoothed;
+#ifdef PITCH_RESTRICT_90_DEG
+    smooth_axis(roll, roll_rate, dt, &roll_smoothed);
+    for (size_t i = 0; i < count; i++)
+        pitch_rate[i] = max_90_deg_correction(pitch_rate[i], roll_smoothed[i]);
+    smooth_axis(pitch, pitch_rate, dt, &pitch_smoothed);
+#else
+    smooth_axis(pitch, pitch_rate, dt, &pitch_smoothed);
+    for (size_t i = 0; i < count; i++)
+        roll_rate[i] = max_90_deg_correction(roll_rate[i], pitch_smoothed[i]);
+    smooth_axis(roll, roll_rate, dt, &roll_smoothed);
+#endif
+
+    double seconds = now_seconds() - start;
+
+    printf("# t_us roll pitch\n");
+    for (size_t i = 0; i < count; i++)
+        printf("%.0f %.4f %.4f\n", records[i].t_us, roll_smoothed[i], pitch_smoothed[i]);
+
+    fprintf(stderr, "%zu samples in %.3f s on %d threads: %.0f samples/s\n",
+            count, seconds, thread_count, count / seconds);
+    return 0;
+}
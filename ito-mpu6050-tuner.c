@@ -0,0 +1,328 @@
+/*
+ Kalman auto-tuner for Q_angle, Q_bias and R_measure over recorded captures.
+
+ Replays a capture through a grid of parameter combinations (logarithmically spaced) and
+ scores every combination against a reference. The reference is the true angles in the
+ capture when it has them, otherwise a smoothed file made by ito-mpu6050-smoother (-r).
+
+   ito-mpu6050-tuner [-n points] [-j threads] [-r smoothed.txt] capture.txt
+
+ Each combination gets two scores, both in degrees and both summed over roll and pitch:
+
+   rms_error   RMS difference between the filtered and the reference angle
+   rms_jitter  RMS difference between the sample-to-sample changes of the filtered and the
+               reference angle, i.e. how much noise the filter lets through
+
+ Lower is better for both and they pull in opposite directions, so the tool prints the
+ Pareto-optimal combinations: those for which no other combination is better in both.
+ Pass the chosen values to the demonstration program with -k Q_angle:Q_bias:R_measure.
+
+ The combinations are run in banks of KalmanBank lanes, and the banks are shared out over
+ all cores. Each bank replays the whole capture on its own, so there is nothing to
+ synchronize and the wall time scales with the number of cores.
+
+ This software may be distributed and modified under the terms of the GNU
+ General Public License version 2 (GPL2) as published by the Free Software
+ Foundation and appearing in the file GPL2.TXT included in the packaging of
+ this file. Please note that GPL2 Section 2[b] requires that all works based
+ on this software must also be made publicly available under the terms of
+ the GPL2 ("Copyleft").
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/* Same convention as ito-mpu6050-kalman-raspberry.c */
+#define PITCH_RESTRICT_90_DEG
+
+#include "FusionEngine.h"
+#include "KalmanBank.h"
+#include "Capture.h"
+
+#define BANK_LANES                     64
+#define DEFAULT_GRID_POINTS            16
+#define WARM_UP_SAMPLES                200
+
+/* Range of the grid for each parameter */
+#define Q_ANGLE_MIN                    1e-5
+#define Q_ANGLE_MAX                    1e-1
+#define Q_BIAS_MIN                     1e-5
+#define Q_BIAS_MAX                     1e-1
+#define R_MEASURE_MIN                  1e-3
+#define R_MEASURE_MAX                  1e+1
+
+int grid_points  = DEFAULT_GRID_POINTS;
+int thread_count = 0;
+
+struct Axis {
+    std::vector<double> angle;
+    std::vector<double> rate;
+    std::vector<double> reference;
+};
+
+struct Combination {
+    double Q_angle;
+    double Q_bias;
+    double R_measure;
+    double rms_error;
+    double rms_jitter;
+};
+
+double now_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+double wrap_180(double angle)
+{
+    return angle - 360.0 * floor((angle + 180.0) / 360.0);
+}
+
+double grid_value(double min, double max, int index)
+{
+    if (grid_points == 1)
+        return sqrt(min * max);
+    return min * pow(max / min, (double)index / (grid_points - 1));
+}
+
+/* Adds the squared errors of one axis for the lanes of one bank, after its step for sample i */
+void score_sample(const Axis &axis, size_t i, const double *angle, double *previous, int lanes,
+                  double *error_sum, double *jitter_sum)
+{
+    double reference_change = wrap_180(axis.reference[i] - axis.reference[i-1]);
+    if (i >= WARM_UP_SAMPLES)
+    {
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            double error  = wrap_180(angle[lane] - axis.reference[i]);
+            double jitter = wrap_180(angle[lane] - previous[lane]) - reference_change;
+            error_sum[lane]  += error * error;
+            jitter_sum[lane] += jitter * jitter;
+        }
+    }
+    for (int lane = 0; lane < lanes; lane++)
+        previous[lane] = angle[lane];
+}
+
+/* Adds the squared errors of both axes for the lanes of one bank. As in KalmanEngine, the axis
+   of ±180 degrees runs first, and the rate of the restricted axis is negated in each lane
+   whose estimate of the other axis is past ±90 degrees */
+void score_axes(const Axis &roll, const Axis &pitch, const std::vector<double> &dt, Combination *combinations,
+                int lanes, double *error_sum, double *jitter_sum)
+{
+    bool pitch_restricted = DEFAULT_ANGLE_CONVENTION == PITCH_RESTRICTED;
+    const Axis &free_axis       = pitch_restricted ? roll : pitch;
+    const Axis &restricted_axis = pitch_restricted ? pitch : roll;
+    KalmanBank<BANK_LANES> free_bank;
+    KalmanBank<BANK_LANES> restricted_bank;
+    double free_rate[BANK_LANES];
+    double restricted_rate[BANK_LANES];
+    double free_previous[BANK_LANES];
+    double restricted_previous[BANK_LANES];
+
+    for (int lane = 0; lane < BANK_LANES; lane++)
+    {
+        const Combination &c = combinations[std::min(lane, lanes - 1)];
+        free_bank.Q_angle[lane]         = c.Q_angle;
+        free_bank.Q_bias[lane]          = c.Q_bias;
+        free_bank.R_measure[lane]       = c.R_measure;
+        restricted_bank.Q_angle[lane]   = c.Q_angle;
+        restricted_bank.Q_bias[lane]    = c.Q_bias;
+        restricted_bank.R_measure[lane] = c.R_measure;
+        free_previous[lane]             = free_axis.angle[0];
+        restricted_previous[lane]       = restricted_axis.angle[0];
+    }
+    free_bank.setAngle(free_axis.angle[0]);
+    restricted_bank.setAngle(restricted_axis.angle[0]);
+
+    for (size_t i = 1; i < dt.size(); i++)
+    {
+        for (int lane = 0; lane < BANK_LANES; lane++)
+            free_rate[lane] = free_axis.rate[i];
+        free_bank.getAngle(free_axis.angle[i], free_rate, dt[i]);
+        const double *free_angle = free_bank.getAngles();
+        for (int lane = 0; lane < BANK_LANES; lane++)
+            restricted_rate[lane] = fabs(free_angle[lane]) > 90 ? -restricted_axis.rate[i] : restricted_axis.rate[i];
+        restricted_bank.getAngle(restricted_axis.angle[i], restricted_rate, dt[i]);
+
+        score_sample(free_axis, i, free_angle, free_previous, lanes, error_sum, jitter_sum);
+        score_sample(restricted_axis, i, restricted_bank.getAngles(), restricted_previous, lanes, error_sum, jitter_sum);
+    }
+}
+
+void tune(const Axis &roll, const Axis &pitch, const std::vector<double> &dt, std::vector<Combination> *combinations)
+{
+    int banks = (int)(combinations->size() + BANK_LANES - 1) / BANK_LANES;
+    double scored = (double)std::max((size_t)1, dt.size() - std::min(dt.size(), (size_t)WARM_UP_SAMPLES));
+    std::atomic<int> next_bank(0);
+
+    auto worker = [&]() {
+        int bank;
+        while ((bank = next_bank++) < banks)
+        {
+            Combination *first = &(*combinations)[bank * BANK_LANES];
+            int lanes = std::min(BANK_LANES, (int)combinations->size() - bank * BANK_LANES);
+            double error_sum[BANK_LANES]  = { 0 };
+            double jitter_sum[BANK_LANES] = { 0 };
+
+            score_axes(roll, pitch, dt, first, lanes, error_sum, jitter_sum);
+            for (int lane = 0; lane < lanes; lane++)
+            {
+                first[lane].rms_error  = sqrt(error_sum[lane] / scored);
+                first[lane].rms_jitter = sqrt(jitter_sum[lane] / scored);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < thread_count; t++)
+        threads.push_back(std::thread(worker));
+    worker();
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+}
+
+bool by_error(const Combination &a, const Combination &b)
+{
+    if (a.rms_error != b.rms_error)
+        return a.rms_error < b.rms_error;
+    return a.rms_jitter < b.rms_jitter;
+}
+
+/* Reads the output of ito-mpu6050-smoother: t_us roll pitch */
+bool load_reference(const char *path, Axis *roll, Axis *pitch, size_t count)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+    char line[256];
+    double t_us, roll_reference, pitch_reference;
+    while (fgets(line, sizeof(line), file) && roll->reference.size() < count)
+    {
+        if (sscanf(line, "%lf %lf %lf", &t_us, &roll_reference, &pitch_reference) != 3)
+            continue;
+        roll->reference.push_back(roll_reference);
+        pitch->reference.push_back(pitch_reference);
+    }
+    fclose(file);
+    return roll->reference.size() == count;
+}
+
+void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-n points] [-j threads] [-r smoothed.txt] capture.txt\n", program);
+    fprintf(stderr, "  -n  Grid points per parameter (default %d)\n", DEFAULT_GRID_POINTS);
+    fprintf(stderr, "  -j  Threads (default all cores)\n");
+    fprintf(stderr, "  -r  Reference made by ito-mpu6050-smoother, needed when the capture has no true angles\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int option;
+    const char *reference_path = NULL;
+
+    while ((option = getopt(argc, argv, "n:j:r:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'n': grid_points    = atoi(optarg); break;
+        case 'j': thread_count   = atoi(optarg); break;
+        case 'r': reference_path = optarg;       break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || grid_points <= 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (thread_count <= 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<CaptureRecord> records;
+    if (!capture_load(argv[optind], &records) || records.size() < 2)
+    {
+        fprintf(stderr, "%s: cannot read capture\n", argv[optind]);
+        return 1;
+    }
+
+    size_t count = records.size();
+    std::vector<double> dt(count);
+    Axis roll, pitch;
+    for (size_t i = 0; i < count; i++)
+    {
+        ImuSample sample = imu_sample_from_raw(records[i].accX, records[i].accY, records[i].accZ,
+                                               records[i].gyroX, records[i].gyroY, records[i].gyroZ);
+        dt[i] = i == 0 ? 0 : (records[i].t_us - records[i-1].t_us) / 1000000;
+        roll.angle.push_back(sample.roll);
+        roll.rate.push_back(sample.roll_rate);
+        pitch.angle.push_back(sample.pitch);
+        pitch.rate.push_back(sample.pitch_rate);
+        if (!reference_path)
+        {
+            if (!records[i].has_truth)
+            {
+                fprintf(stderr, "%s: no true angles in the capture, pass a smoothed reference with -r\n", argv[optind]);
+                return 1;
+            }
+            roll.reference.push_back(records[i].roll_true);
+            pitch.reference.push_back(records[i].pitch_true);
+        }
+    }
+    if (reference_path && !load_reference(reference_path, &roll, &pitch, count))
+    {
+        fprintf(stderr, "%s: cannot read a reference with %zu samples\n", reference_path, count);
+        return 1;
+    }
+
+    /* The sign of the restricted axis rate follows the reference of the continuous axis */
+    for (size_t i = 0; i < count; i++)
+#ifdef PITCH_RESTRICT_90_DEG
+        pitch.rate[i] = max_90_deg_correction(pitch.rate[i], roll.reference[i]);
+#else
+        roll.rate[i] = max_90_deg_correction(roll.rate[i], pitch.reference[i]);
+#endif
+
+    std::vector<Combination> combinations;
+    for (int a = 0; a < grid_points; a++)
+        for (int b = 0; b < grid_points; b++)
+            for (int r = 0; r < grid_points; r++)
+            {
+                Combination c;
+                c.Q_angle   = grid_value(Q_ANGLE_MIN, Q_ANGLE_MAX, a);
+                c.Q_bias    = grid_value(Q_BIAS_MIN, Q_BIAS_MAX, b);
+                c.R_measure = grid_value(R_MEASURE_MIN, R_MEASURE_MAX, r);
+                combinations.push_back(c);
+            }
+
+    double start = now_seconds();
+    tune(roll, pitch, dt, &combinations);
+    double seconds = now_seconds() - start;
+
+    std::sort(combinations.begin(), combinations.end(), by_error);
+    printf("# Pareto-optimal settings, lowest error first\n");
+    printf("%-12s %-12s %-12s %10s %10s\n", "Q_angle", "Q_bias", "R_measure", "rms_error", "rms_jitter");
+    double best_jitter = INFINITY;
+    for (size_t i = 0; i < combinations.size(); i++)
+    {
+        const Combination &c = combinations[i];
+        if (c.rms_jitter >= best_jitter)
+            continue;
+        best_jitter = c.rms_jitter;
+        printf("%-12.4g %-12.4g %-12.4g %10.4f %10.4f\n", c.Q_angle, c.Q_bias, c.R_measure, c.rms_error, c.rms_jitter);
+    }
+
+    fprintf(stderr, "%zu combinations x %zu samples in %.3f s on %d threads: %.3g filter updates/s\n",
+            combinations.size(), count, seconds, thread_count, 2.0 * combinations.size() * count / seconds);
+    return 0;
+}